@@ -14,6 +14,7 @@
 
 #include <string.h>
 #include <limits.h>
+#include <pthread.h>
 #include "vdisk.h"
 
 // Implementation of min operator
@@ -149,11 +150,62 @@ typedef union block_u
 /**********************************************************************/
 // Representing files (project 4!)
 
-typedef struct oufile_s
+// State of an open file that all of its OUFILEs share: one per inode,
+//  however many times (and by however many threads) the file is open
+typedef struct oufs_open_inode_s
 {
   INODE_REFERENCE inode_reference;
+  // Number of OUFILEs referring to this entry
+  int n_open;
+
+  // Readers hold lock for reading, writers (and flushes) for writing
+  pthread_rwlock_t lock;
+
+  // Copy of the file's inode; written back when inode_dirty is set
+  INODE inode;
+  int inode_dirty;
+
+  // Write cache: file block i is in cache[i] when bit i of cached is set;
+  //  bit i of dirty marks changes that are not on the disk yet (and that
+  //  may not have a data block yet)
+  unsigned int cached;
+  unsigned int dirty;
+  BLOCK cache[BLOCKS_PER_INODE];
+
+  // Bit i set: data[i] is shared with a clone and is copied before its
+  //  first write (copy on write)
+  unsigned int shared;
+
+  // Bumped by every change to the contents: readahead buffers filled
+  //  under an older generation are stale
+  unsigned int generation;
+
+  // Set when the file lost its last name while open: it is released when
+  //  the last OUFILE closes
+  int unlinked;
+} OUFS_OPEN_INODE;
+
+// One open file.  An OUFILE is used by one thread at a time; threads that
+//  share a file each open their own.
+typedef struct oufile_s
+{
+  OUFS_OPEN_INODE *node;
   char mode;
   int offset;
+
+  // Readahead (reads only): file blocks ra_start ... ra_start+ra_count-1
+  //  are in ra_buffer, as of node generation ra_generation.  ra_next is the
+  //  block a sequential reader asks for next; ra_window is the number of
+  //  blocks fetched on the next miss.
+  int ra_start;
+  int ra_count;
+  int ra_next;
+  int ra_window;
+  unsigned int ra_generation;
+  BLOCK ra_buffer[BLOCKS_PER_INODE];
+
+  // Block pinned by oufs_fread_zerocopy() (UNALLOCATED_BLOCK: none)
+  BLOCK_REFERENCE pinned;
 } OUFILE;
 
 
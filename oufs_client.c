@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include "oufs_client.h"
+
+/**
+ * Name of the socket of the oufsd serving a disk: ZSOCKET if it is set,
+ * otherwise the disk's name followed by .sock
+ *
+ * @param disk_name File name of the virtual disk
+ * @param socket_name String buffer (MAX_PATH_LENGTH) for the socket's name
+ */
+void oufs_socket_name(char *disk_name, char *socket_name)
+{
+  char *str = getenv("ZSOCKET");
+  if(str != NULL)
+    snprintf(socket_name, MAX_PATH_LENGTH, "%s", str);
+  else
+    snprintf(socket_name, MAX_PATH_LENGTH, "%s.sock", disk_name);
+}
+
+/**
+ * Is there an oufsd socket for a disk?  (Tools that must consume stdin
+ * before talking to oufsd check this first.)
+ *
+ * @param disk_name File name of the virtual disk
+ * @return 1 if the socket exists; 0 otherwise
+ */
+int oufs_remote_running(char *disk_name)
+{
+  char socket_name[MAX_PATH_LENGTH];
+  struct stat st;
+
+  oufs_socket_name(disk_name, socket_name);
+  return(stat(socket_name, &st) == 0 && S_ISSOCK(st.st_mode));
+}
+
+/**
+ * Read standard input into a buffer
+ *
+ * @param buf Buffer of at least max bytes
+ * @param max Most bytes to read
+ * @return Number of bytes read
+ */
+int oufs_read_input(unsigned char *buf, int max)
+{
+  int n = 0;
+  size_t r;
+
+  while(n < max && (r = fread(buf + n, 1, max - n, stdin)) > 0)
+    n += r;
+  return(n);
+}
+
+/**
+ * Read exactly n bytes
+ *
+ * @return 0 on success; -1 on error or end of file
+ */
+int oufs_read_full(int fd, void *buf, size_t n)
+{
+  char *p = buf;
+
+  while(n > 0) {
+    ssize_t r = read(fd, p, n);
+    if(r < 0 && errno == EINTR)
+      continue;
+    if(r <= 0)
+      return(-1);
+    p += r;
+    n -= r;
+  }
+  return(0);
+}
+
+/**
+ * Write exactly n bytes to a socket.  A peer that has gone away is an
+ * error, not a SIGPIPE.
+ *
+ * @return 0 on success; -1 on error
+ */
+int oufs_write_full(int fd, const void *buf, size_t n)
+{
+  const char *p = buf;
+
+  while(n > 0) {
+    ssize_t r = send(fd, p, n, MSG_NOSIGNAL);
+    if(r < 0 && errno == EINTR)
+      continue;
+    if(r < 0)
+      return(-1);
+    p += r;
+    n -= r;
+  }
+  return(0);
+}
+
+/**
+ * Copy n bytes from a socket to a stream
+ *
+ * @return 0 on success; -1 on error
+ */
+static int oufs_copy_out(int fd, uint32_t n, FILE *stream)
+{
+  char buf[BLOCK_SIZE];
+
+  while(n > 0) {
+    uint32_t m = MIN(n, sizeof(buf));
+    if(oufs_read_full(fd, buf, m) != 0)
+      return(-1);
+    fwrite(buf, 1, m, stream);
+    n -= m;
+  }
+  return(0);
+}
+
+/**
+ * Run an operation in the oufsd serving a disk, if one is running.  Its
+ * output goes to stdout and stderr as if the operation had run here.
+ *
+ * @param disk_name File name of the virtual disk
+ * @param op Operation (OUFS_OP_...)
+ * @param flags Flags (OUFS_FLAG_...)
+ * @param cwd Absolute path representing the current working directory
+ * @param path First path (or NULL)
+ * @param path2 Second path (or NULL)
+ * @param data Data (or NULL)
+ * @param data_len Number of bytes of data
+ * @param status Set to the operation's result
+ * @return 0 if the daemon ran the operation; -1 if there is no daemon (run
+ *         the operation locally); -2 if the daemon was reached but did not
+ *         answer (it may have run the operation: do not run it again)
+ */
+int oufs_remote(char *disk_name, int op, int flags, char *cwd, char *path, char *path2,
+		const void *data, int data_len, int *status)
+{
+  char socket_name[MAX_PATH_LENGTH];
+  struct sockaddr_un addr;
+  OUFS_REQUEST request;
+  OUFS_RESPONSE response;
+
+  oufs_socket_name(disk_name, socket_name);
+  if(strlen(socket_name) >= sizeof(addr.sun_path))
+    return(-1);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_name);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0)
+    return(-1);
+  if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+    // Not running
+    close(fd);
+    return(-1);
+  }
+
+  if(path == NULL)
+    path = "";
+  if(path2 == NULL)
+    path2 = "";
+  request.magic = OUFS_MAGIC;
+  request.op = op;
+  request.flags = flags;
+  request.cwd_len = strnlen(cwd, MAX_PATH_LENGTH - 1);
+  request.path_len = strnlen(path, MAX_PATH_LENGTH - 1);
+  request.path2_len = strnlen(path2, MAX_PATH_LENGTH - 1);
+  request.data_len = MIN(data_len, OUFS_MAX_DATA);
+
+  int ret = -2;
+  if(oufs_write_full(fd, &request, sizeof(request)) == 0 &&
+     oufs_write_full(fd, cwd, request.cwd_len) == 0 &&
+     oufs_write_full(fd, path, request.path_len) == 0 &&
+     oufs_write_full(fd, path2, request.path2_len) == 0 &&
+     oufs_write_full(fd, data, request.data_len) == 0 &&
+     oufs_read_full(fd, &response, sizeof(response)) == 0 &&
+     oufs_copy_out(fd, response.out_len, stdout) == 0 &&
+     oufs_copy_out(fd, response.err_len, stderr) == 0) {
+    *status = response.status;
+    ret = 0;
+  }else{
+    fprintf(stderr, "oufsd (%s): no answer\n", socket_name);
+  }
+  close(fd);
+  return(ret);
+}
@@ -0,0 +1,66 @@
+#ifndef OUFS_CLIENT
+#define OUFS_CLIENT
+#include <stdint.h>
+#include "oufs_lib.h"
+
+/**********************************************************************/
+// oufsd: a daemon that keeps a disk open and serves file system operations
+// over a Unix domain socket.  A client connects, sends one request and
+// reads one response.
+//
+// Request: OUFS_REQUEST, then cwd, path, path2 (not NUL terminated) and
+//  data_len bytes of data
+// Response: OUFS_RESPONSE, then out_len bytes for stdout and err_len bytes
+//  for stderr
+
+#define OUFS_MAGIC 0x5346554f
+
+// Operations
+#define OUFS_OP_MKDIR 1
+#define OUFS_OP_RMDIR 2
+#define OUFS_OP_TOUCH 3
+#define OUFS_OP_LIST 4
+#define OUFS_OP_READ 5
+#define OUFS_OP_CREATE 6
+#define OUFS_OP_APPEND 7
+#define OUFS_OP_REMOVE 8
+#define OUFS_OP_RENAME 9
+
+// Flags
+// OUFS_OP_LIST: long format
+#define OUFS_FLAG_LONG 1
+// OUFS_OP_REMOVE: the whole subtree
+#define OUFS_FLAG_RECURSIVE 2
+
+// Most data in one request (a whole file, and one byte to tell that it is
+// too large)
+#define OUFS_MAX_DATA (BLOCKS_PER_INODE * BLOCK_SIZE + 1)
+
+typedef struct oufs_request_s
+{
+  uint32_t magic;
+  uint8_t op;
+  uint8_t flags;
+  uint16_t cwd_len;
+  uint16_t path_len;
+  uint16_t path2_len;
+  uint32_t data_len;
+} OUFS_REQUEST;
+
+typedef struct oufs_response_s
+{
+  // What the operation returned (the z* tool's exit status)
+  int32_t status;
+  uint32_t out_len;
+  uint32_t err_len;
+} OUFS_RESPONSE;
+
+void oufs_socket_name(char *disk_name, char *socket_name);
+int oufs_remote_running(char *disk_name);
+int oufs_read_input(unsigned char *buf, int max);
+int oufs_read_full(int fd, void *buf, size_t n);
+int oufs_write_full(int fd, const void *buf, size_t n);
+int oufs_remote(char *disk_name, int op, int flags, char *cwd, char *path, char *path2,
+		const void *data, int data_len, int *status);
+
+#endif
@@ -4,6 +4,36 @@
 
 #define MAX_PATH_LENGTH 200
 
+// Iterator over the components of a path (see oufs_path_iter_next())
+typedef struct oufs_path_iter_s
+{
+  const char *next;
+} OUFS_PATH_ITER;
+
+// Directory entry as returned by oufs_readdir()
+typedef struct oudirent_s
+{
+  char name[FILE_NAME_SIZE];
+  INODE_REFERENCE inode_reference;
+  // IT_DIRECTORY or IT_FILE
+  char type;
+  // The remaining attributes are only filled in by oufs_readdirplus()
+  unsigned char n_references;
+  unsigned int size;
+} OUDIRENT;
+
+// Directory stream: entries of an open directory, sorted by name
+typedef struct oudir_s
+{
+  INODE_REFERENCE inode_reference;
+  OUDIRENT *entries;
+  int n_entries;
+  // Index of the next entry to be returned
+  int next;
+  // Non-zero once all entry attributes have been prefetched
+  int attributes_loaded;
+} OUDIR;
+
 // PROVIDED
 void oufs_get_environment(char *cwd, char *disk_name);
 
@@ -11,28 +41,72 @@ void oufs_get_environment(char *cwd, char *disk_name);
 int oufs_format_disk(char *virtual_disk_name);
 int oufs_read_inode_by_reference(INODE_REFERENCE i, INODE *inode);
 int oufs_write_inode_by_reference(INODE_REFERENCE i, INODE *inode);
+int oufs_write_inodes(int n, const INODE_REFERENCE *refs, const INODE *inodes);
 int oufs_find_file(char *cwd, char * path, INODE_REFERENCE *parent, INODE_REFERENCE *child, char *local_name);
+int oufs_find_file_at(INODE_REFERENCE start, const char *path, INODE_REFERENCE *parent,
+		      INODE_REFERENCE *child, char *local_name);
+void oufs_path_iter_init(OUFS_PATH_ITER *it, const char *path);
+int oufs_path_iter_next(OUFS_PATH_ITER *it, const char **name, size_t *len);
 int oufs_mkdir(char *cwd, char *path);
 int oufs_list(char *cwd, char *path);
+OUDIR* oufs_opendir(char *cwd, char *path);
+OUDIRENT* oufs_readdir(OUDIR *dir);
+OUDIRENT* oufs_readdirplus(OUDIR *dir);
+int oufs_list_long(char *cwd, char *path);
+void oufs_closedir(OUDIR *dir);
 int oufs_rmdir(char *cwd, char *path);
 int oufs_ztouch(char *cwd, char* path);
 int oufs_zcreate(char *cwd, char* path);
+INODE_REFERENCE oufs_create_file(INODE_REFERENCE parentRef, char *local_name);
 // Helper functions in oufs_lib_support.c
 void oufs_clean_directory_block(INODE_REFERENCE self, INODE_REFERENCE parent, BLOCK *block);
 INODE_REFERENCE oufs_allocate_new_inode();
 void oufs_clean_directory_entry(DIRECTORY_ENTRY *entry);
 BLOCK_REFERENCE oufs_allocate_new_block();
+int oufs_allocate_new_blocks(int n, BLOCK_REFERENCE *refs);
+int oufs_allocate_new_inodes(int n, INODE_REFERENCE *refs);
+int oufs_block_reference_counts(unsigned char *counts);
+void oufs_deallocate_inode(INODE_REFERENCE i);
+void oufs_deallocate_block(BLOCK_REFERENCE b);
 INODE_REFERENCE oufs_allocate_new_directory(INODE_REFERENCE parent);
 INODE_REFERENCE oufs_find_directory_element(INODE *inode, char *directory_name);
+INODE_REFERENCE oufs_find_directory_element_n(INODE *inode, const char *name, size_t len);
+INODE_REFERENCE oufs_lookup_directory_element(INODE_REFERENCE dir, INODE *inode, char *name);
+// Sorted directory blocks
+int oufs_directory_block_is_sorted(const BLOCK *block, int first);
+int oufs_directory_insert_entry(INODE_REFERENCE dir_ref, INODE *dir, const char *name,
+				INODE_REFERENCE ref);
+INODE_REFERENCE oufs_directory_remove_entry(INODE_REFERENCE dir_ref, INODE *dir,
+					    const char *name, size_t len);
+INODE_REFERENCE oufs_directory_replace_entry(INODE *dir, const char *name, size_t len,
+					     INODE_REFERENCE ref);
+INODE_REFERENCE oufs_lookup_directory_element_n(INODE_REFERENCE dir, INODE *inode,
+						const char *name, size_t len);
+// Per-directory Bloom filters (negative lookup cache)
+void oufs_bloom_add(INODE_REFERENCE dir, const char *name);
+void oufs_bloom_invalidate(INODE_REFERENCE dir);
+void oufs_bloom_reset();
+int oufs_bloom_may_contain(INODE_REFERENCE dir, INODE *inode, const char *name, size_t len);
 // Helper functions to be provided
 int oufs_find_open_bit(unsigned char value);
 
 // PROJECT 4 ONLY
 OUFILE* oufs_fopen(char *cwd, char *path, char *mode);
-void oufs_fclose(OUFILE *fp);
+int oufs_fclose(OUFILE *fp);
+int oufs_fflush(OUFILE *fp);
 int oufs_fwrite(OUFILE *fp, unsigned char * buf, int len);
 int oufs_fread(OUFILE *fp, unsigned char * buf, int len);
+int oufs_fread_zerocopy(OUFILE *fp, const unsigned char **data, int len);
+int oufs_freadv(OUFILE *fp, const struct iovec *iov, int iovcnt);
+int oufs_fwritev(OUFILE *fp, const struct iovec *iov, int iovcnt);
+int oufs_fseek(OUFILE *fp, long offset, int whence);
+long oufs_ftell(OUFILE *fp);
+int oufs_fallocate(OUFILE *fp, int offset, int len);
+int oufs_ftruncate(OUFILE *fp, int length);
 int oufs_remove(char *cwd, char *path);
+int oufs_remove_recursive(char *cwd, char *path);
 int oufs_link(char *cwd, char *path_src, char *path_dst);
+int oufs_clone(char *cwd, char *path_src, char *path_dst);
+int oufs_rename(char *cwd, char *path_src, char *path_dst);
 
 #endif
@@ -3,9 +3,15 @@
 #include <dirent.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <pthread.h>
 #include "oufs_lib.h"
 
 #define debug 0
+
+// Serializes read-modify-write updates of the master block (allocation
+// tables), which threads working on different files may make at once
+static pthread_mutex_t oufs_master_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /**
  * Read the ZPWD and ZDISK environment variables & copy their values into cwd and 
  * disk_name.
@@ -99,6 +105,7 @@ BLOCK_REFERENCE oufs_allocate_new_block()
 {
   BLOCK block;
   // Read the master block
+  pthread_mutex_lock(&oufs_master_lock);
   vdisk_read_block(MASTER_BLOCK_REFERENCE, &block);
 
   // Scan for an available block
@@ -116,6 +123,7 @@ BLOCK_REFERENCE oufs_allocate_new_block()
   // Did we find a candidate byte in the table?
   if(flag == 1) {
     // No
+    pthread_mutex_unlock(&oufs_master_lock);
     if(debug)
       fprintf(stderr, "No blocks\n");
     return(UNALLOCATED_BLOCK);
@@ -132,6 +140,7 @@ BLOCK_REFERENCE oufs_allocate_new_block()
 
   // Write out the updated master block
   vdisk_write_block(MASTER_BLOCK_REFERENCE, &block);
+  pthread_mutex_unlock(&oufs_master_lock);
 
   if(debug)
     fprintf(stderr, "Allocating block=%d (%d)\n", block_byte, block_bit);
@@ -147,6 +156,68 @@ BLOCK_REFERENCE oufs_allocate_new_block()
 }
 
 
+/**
+ * Allocate several data blocks with a single update of the block allocation
+ * table
+ *
+ * A run of n consecutive free blocks is preferred (the first one found), so
+ * that the data can go out in one vectored write; otherwise the lowest free
+ * blocks are taken.
+ *
+ * @param n Number of blocks wanted
+ * @param refs Filled in with the allocated blocks (in increasing order)
+ * @return Number of blocks allocated: less than n if the disk is full
+ */
+int oufs_allocate_new_blocks(int n, BLOCK_REFERENCE *refs)
+{
+  BLOCK block;
+  int count = 0;
+
+  if(n <= 0)
+    return(0);
+
+  // Read the master block
+  pthread_mutex_lock(&oufs_master_lock);
+  vdisk_read_block(MASTER_BLOCK_REFERENCE, &block);
+  unsigned char *flags = block.master.block_allocated_flag;
+
+  // First fit: a run of n free blocks
+  int run = 0;
+  for(int b = 0; b < N_BLOCKS_IN_DISK && run < n; ++b) {
+    if(flags[b >> 3] & (1 << (b & 7)))
+      run = 0;
+    else if(++run == n)
+      for(int i = 0; i < n; ++i)
+	refs[i] = b - n + 1 + i;
+  }
+  if(run == n) {
+    count = n;
+  }else{
+    // Scattered: the lowest free blocks
+    for(int b = 0; b < N_BLOCKS_IN_DISK && count < n; ++b)
+      if(!(flags[b >> 3] & (1 << (b & 7))))
+	refs[count++] = b;
+  }
+  if(count == 0) {
+    pthread_mutex_unlock(&oufs_master_lock);
+    if(debug)
+      fprintf(stderr, "No blocks\n");
+    return(0);
+  }
+
+  for(int i = 0; i < count; ++i)
+    flags[refs[i] >> 3] |= (1 << (refs[i] & 7));
+
+  // Write out the updated master block
+  vdisk_write_block(MASTER_BLOCK_REFERENCE, &block);
+  pthread_mutex_unlock(&oufs_master_lock);
+
+  if(debug)
+    fprintf(stderr, "Allocating %d blocks from block=%d\n", count, refs[0]);
+
+  return(count);
+}
+
 /**
  *  Given an inode reference, read the inode from the virtual disk.
  *
@@ -166,10 +237,12 @@ int oufs_read_inode_by_reference(INODE_REFERENCE i, INODE *inode)
   BLOCK_REFERENCE block = i / INODES_PER_BLOCK + 1;
   int element = (i % INODES_PER_BLOCK);
 
-  BLOCK b;
-  if(vdisk_read_block(block, &b) == 0) {
+  // Pin the inode block rather than copying all of it
+  const BLOCK *b = vdisk_pin_block(block);
+  if(b != NULL) {
     // Successfully loaded the block: copy just this inode
-    *inode = b.inodes.inode[element];
+    *inode = b->inodes.inode[element];
+    vdisk_unpin_block(block);
     return(0);
   }
   // Error case
@@ -219,16 +292,11 @@ int oufs_ztouch(char *cwd, char* path)
     INODE_REFERENCE parentRef;
     INODE_REFERENCE childRef;
 
-    // block object
-    BLOCK block;
-    //INODE_REFERENCE inodeRef;
-    INODE parent;
     // holds the local namee
     char local_name[MAX_PATH_LENGTH];
     // retrun flag
     int ret;
 
-    int flag = 0;
     // Attempt to find the specified directory
     if((ret = oufs_find_file(cwd, path, &parentRef, &childRef, local_name)) < -1)
     {
@@ -236,66 +304,63 @@ int oufs_ztouch(char *cwd, char* path)
 	    fprintf(stderr, "oufs_ztouch(): ret = %d\n", ret);
 	return(-1);
     }
-    if(childRef != UNALLOCATED_BLOCK)
+    if(childRef != UNALLOCATED_INODE)
     {
 	return -1;
     }
-
-    // clean memory then read inode by reference 
-    memset(&block, 0, 256);
-    oufs_read_inode_by_reference(parentRef, &parent);
-    // then read block of the the mster parent block
-    vdisk_read_block(parent.data[0], &block);
-    
-    // loop directory  then string local_name to entry name 
-    for(int i = 0; i < DIRECTORY_ENTRIES_PER_BLOCK; ++i)
+    if(parentRef == UNALLOCATED_INODE)
     {
-	if(block.directory.entry[i].inode_reference == UNALLOCATED_INODE)
-	{
-
-	    //block.directory.entry[i].inode_reference = inodeRef;
-	    strcpy(block.directory.entry[i].name, local_name);
-	 
-	    // flag is good
-	    flag = i;
-	    
-
-	    break;
-	}	
+	fprintf(stderr, "%s: parent directory does not exist\n", path);
+	return -1;
     }
-    
-    // if directory block is full, then error
-    if(flag == 0)
+
+    if(oufs_create_file(parentRef, local_name) == UNALLOCATED_INODE)
     {
-	fprintf(stderr, "Directory block is full!\n");
 	return -1;
     }
-    // allocate new inode, then assing inode refference 
-    INODE_REFERENCE inodeRef = oufs_allocate_new_inode();
-    block.directory.entry[flag].inode_reference = inodeRef;
+    return 1;
+
+}
+
+/**
+ * Create an empty file in a directory
+ *
+ * @param parentRef Inode reference of the directory
+ * @param local_name Name of the new file (must not exist yet)
+ * @return Inode reference of the new file; UNALLOCATED_INODE on error
+ */
+INODE_REFERENCE oufs_create_file(INODE_REFERENCE parentRef, char *local_name)
+{
+    INODE parent;
 
-    // write the parent master block 
-    vdisk_write_block(parent.data[0], &block);
+    // allocate new inode for the file
+    INODE_REFERENCE inodeRef = oufs_allocate_new_inode();
+    if(inodeRef == UNALLOCATED_INODE)
+    {
+	fprintf(stderr, "All inodes are full!\n");
+	return UNALLOCATED_INODE;
+    }
 
     // set variables that actually create a file, write it
     INODE in;
-    memset(&in, 0, 36);
-    in.type = 'F';
+    memset(&in, 0, sizeof(INODE));
+    in.type = IT_FILE;
     in.n_references = 1;
     for(int i = 0; i < BLOCKS_PER_INODE; ++i)
     {
 	in.data[i] = UNALLOCATED_BLOCK;
     }
     in.size = 0;
-
-    // locad the parent reference
-    oufs_read_inode_by_reference(parentRef, &parent);
-    // increment the parent size, write the parent and child reference
-    parent.size++;
-    oufs_write_inode_by_reference(parentRef, &parent);
     oufs_write_inode_by_reference(inodeRef, &in);
-    return 1;
 
+    // add the name to the parent (this also updates the parent size)
+    oufs_read_inode_by_reference(parentRef, &parent);
+    if(oufs_directory_insert_entry(parentRef, &parent, local_name, inodeRef) != 0)
+    {
+	oufs_deallocate_inode(inodeRef);
+	return UNALLOCATED_INODE;
+    }
+    return inodeRef;
 }
 
 /**
@@ -322,7 +387,6 @@ int oufs_mkdir(char *cwd, char *path)
     // return flag
     int ret;
 
-    int flag = 0;
     // Attempt to find the specified directory, throw error when necessary, break
     if((ret = oufs_find_file(cwd, path, &parentRef, &childRef, local_name)) < -1)
     {
@@ -330,75 +394,56 @@ int oufs_mkdir(char *cwd, char *path)
 	    fprintf(stderr, "oufs_mkdir(): ret = %d\n", ret);
 	return(-1);
     }
-    if(childRef != UNALLOCATED_BLOCK)
+    if(childRef != UNALLOCATED_INODE)
     {
 	return -1;
     }
-
-    // clean memory, read inode parent reference, vdisk read parent data
-    memset(&block, 0, 256);
-    oufs_read_inode_by_reference(parentRef, &parent);
-    vdisk_read_block(parent.data[0], &block);
-    
-    // loop direcotry entries, if the inode reference is unallocated,
-    // then copy local name to entry name 
-    for(int i = 0; i < DIRECTORY_ENTRIES_PER_BLOCK; ++i)
+    if(parentRef == UNALLOCATED_INODE)
     {
-	if(block.directory.entry[i].inode_reference == UNALLOCATED_INODE)
-	{
-
-	    //block.directory.entry[i].inode_reference = inodeRef;
-	    strcpy(block.directory.entry[i].name, local_name);
-	 
-	    flag = i;
-	    
+	fprintf(stderr, "%s: parent directory does not exist\n", path);
+	return -1;
+    }
 
-	    break;
-	}	
+    // allocate new inode and the block for the directory contents
+    INODE_REFERENCE inodeRef = oufs_allocate_new_inode();
+    if(inodeRef == UNALLOCATED_INODE)
+    {
+	fprintf(stderr, "All inodes are full!\n");
+	return -1;
     }
-    
-    // if directory block is full
-    if(flag == 0)
+    BLOCK_REFERENCE blockRef = oufs_allocate_new_block();
+    if(blockRef == UNALLOCATED_BLOCK)
     {
-	fprintf(stderr, "Directory block is full!\n");
+	fprintf(stderr, "All blocks are full!\n");
+	oufs_deallocate_inode(inodeRef);
 	return -1;
     }
-    // allocate new inode entry flag inode set to inode reference 
-    INODE_REFERENCE inodeRef = oufs_allocate_new_inode();
-    block.directory.entry[flag].inode_reference = inodeRef;
-
-    // vdisk write parent block
-    vdisk_write_block(parent.data[0], &block);
 
     // set variables to actually make a directory
     INODE in;
-    memset(&in, 0, 36);
-    in.type = 'D';
+    memset(&in, 0, sizeof(INODE));
+    in.type = IT_DIRECTORY;
     in.n_references = 1;
-    in.data[0] = oufs_allocate_new_block();
+    in.data[0] = blockRef;
     for(int i = 1; i < BLOCKS_PER_INODE; ++i)
     {
 	in.data[i] = UNALLOCATED_BLOCK;
     }
     in.size = 2;
     oufs_write_inode_by_reference(inodeRef, &in);
-    // clean memory, set dblocks to correct values, then write the block
-    memset(&block, 0, 256);
-    strcpy(block.directory.entry[0].name, ".");
-    strcpy(block.directory.entry[1].name, "..");
-    block.directory.entry[0].inode_reference = inodeRef;
-    block.directory.entry[1].inode_reference = parentRef;
 
-   
-    for(int i = 2; i < DIRECTORY_ENTRIES_PER_BLOCK; ++i)
+    // the new directory block holds only . and ..
+    oufs_clean_directory_block(inodeRef, parentRef, &block);
+    vdisk_write_block(blockRef, &block);
+
+    // add the name to the parent (this also updates the parent size)
+    oufs_read_inode_by_reference(parentRef, &parent);
+    if(oufs_directory_insert_entry(parentRef, &parent, local_name, inodeRef) != 0)
     {
-	block.directory.entry[i].inode_reference = UNALLOCATED_INODE;
+	oufs_deallocate_block(blockRef);
+	oufs_deallocate_inode(inodeRef);
+	return -1;
     }
-    vdisk_write_block(in.data[0], &block);
-    // read the inode, then update changes
-    oufs_read_inode_by_reference(parentRef, &parent);
-    parent.size++;
-    oufs_write_inode_by_reference(parentRef, &parent);
     return 1;
 
 }
@@ -490,139 +535,195 @@ int oufs_format_disk(char *virtual_disk_name)
     // write the root directory block
     vdisk_write_block(ROOT_DIRECTORY_BLOCK, &b.directory);
 
+    // Nothing cached about the old contents is valid any more
+    oufs_bloom_reset();
+
     return 0;
 }
 
 
 /**
- *  Given a current working directory and either an absolute or relative path, find both the inode of the
- * file or directory and the inode of the parent directory.  If one or both are not found, then they are
- * set to UNALLOCATED_INODE.
+ * Start iterating over the components of a path.  The iterator only keeps a
+ * pointer into the caller's string, which is never modified, so any number
+ * of iterators (in any number of threads) can be active at once.
  *
- *  This implementation handles a variety of strange cases, such as consecutive /'s and /'s at the end of
- * of the path (we have to maintain some extra state to make this work properly).
+ * @param it Iterator to initialize
+ * @param path Path to iterate over
+ */
+void oufs_path_iter_init(OUFS_PATH_ITER *it, const char *path)
+{
+  it->next = path;
+}
+
+/**
+ * Fetch the next non-empty component of a path.  Consecutive /'s and /'s at
+ * either end of the path are skipped.
  *
- * @param cwd Absolute path for the current working directory
+ * @param it Iterator
+ * @param name Set to the start of the component (NOT null terminated)
+ * @param len Set to the length of the component
+ * @return 1 if a component was found, 0 at the end of the path
+ */
+int oufs_path_iter_next(OUFS_PATH_ITER *it, const char **name, size_t *len)
+{
+  const char *p = it->next;
+
+  while(*p == '/')
+    ++p;
+  if(*p == 0) {
+    it->next = p;
+    return(0);
+  }
+
+  *name = p;
+  while(*p != 0 && *p != '/')
+    ++p;
+  *len = p - *name;
+  it->next = p;
+  return(1);
+}
+
+/**
+ * Copy a path component into a local name buffer
+ */
+static void oufs_copy_local_name(char *local_name, const char *name, size_t len)
+{
+  if(local_name == NULL)
+    return;
+  len = MIN(len, FILE_NAME_SIZE - 1);
+  memcpy(local_name, name, len);
+  local_name[len] = 0;
+}
+
+/**
+ *  Starting from a given directory, walk an absolute or relative path and find both the inode of
+ * the file or directory and the inode of the parent directory.  If one or both are not found, then
+ * they are set to UNALLOCATED_INODE.  An absolute path always starts from the root, so a caller that
+ * already knows the inode of its current working directory never has to re-walk it from the root.
+ *
+ *  Path components are examined in place (the path is never copied or modified), and only the first
+ * FILE_NAME_SIZE-1 characters of each component are significant.  This function is reentrant.
+ *
+ * @param start Inode reference of the directory that relative paths start from
  * @param path Absolute or relative path of the file/directory to be found
  * @param parent Inode reference for the parent directory
  * @param child  Inode reference for the file or directory specified by path
  * @param local_name String name of the file or directory without any path information (i.e., name relative
- *        to the parent)
+ *        to the parent).  May be NULL.
  * @return 0 if no errors
- *         -1 if child not found
+ *         -1 if child not found (parent is set if it exists)
  *         -x if an error
  *
  */
-int oufs_find_file(char *cwd, char * path, INODE_REFERENCE *parent, INODE_REFERENCE *child, char *local_name)
+int oufs_find_file_at(INODE_REFERENCE start, const char *path, INODE_REFERENCE *parent,
+		      INODE_REFERENCE *child, char *local_name)
 {
-  // grand parent 
-  INODE_REFERENCE grandparent;
-  char full_path[MAX_PATH_LENGTH];
+  OUFS_PATH_ITER it;
+  const char *name;
+  size_t len;
+  INODE inode;
+  int n_components = 0;
 
-  // Construct an absolute path the file/directory in question
   if(path[0] == '/')
-  {
-    strncpy(full_path, path, MAX_PATH_LENGTH-1);
-  }
-  else // the path is not containing a root
-  {
-    if(strlen(cwd) > 1)
-    {
-      strncpy(full_path, cwd, MAX_PATH_LENGTH-1);
-      strncat(full_path, "/", 2);
-      strncat(full_path, path, MAX_PATH_LENGTH-1-strnlen(full_path, MAX_PATH_LENGTH));
-    }else{
-      strncpy(full_path, "/", 2);
-      strncat(full_path, path, MAX_PATH_LENGTH-2);
-    }
-  }
-
-  if(debug) {
-    fprintf(stderr, "Full path: %s\n", full_path);
-  };
+    start = 0;
+  if(start >= N_INODES)
+    return(-3);
 
-  // Start scanning from the root directory
-  // Root directory inode
-  grandparent = *parent = *child = 0;
+  *parent = *child = start;
   if(debug)
-    fprintf(stderr, "Start search: %d\n", *parent);
-
-  // Parse the full path
-  char *directory_name;
-  directory_name = strtok(full_path, "/");
-  while(directory_name != NULL) {
-    if(strlen(directory_name) >= FILE_NAME_SIZE-1) 
-      // Truncate the name
-      directory_name[FILE_NAME_SIZE - 1] = 0;
-    if(debug){
-      fprintf(stderr, "Directory: %s\n", directory_name);
-    }
-    if(strlen(directory_name) != 0) {
-      // We have a non-empty name
-      // Remember this name
-      if(local_name != NULL) {
-	// Copy local name of file 
-	strncpy(local_name, directory_name, MAX_PATH_LENGTH-1);
-	// Make sure we have a termination
-	local_name[MAX_PATH_LENGTH-1] = 0;
-      }
+    fprintf(stderr, "Start search: %d (%s)\n", start, path);
 
-      // Real next element
-      INODE inode;
-      // Fetch the inode that corresponds to the child
-      if(oufs_read_inode_by_reference(*child, &inode) != 0) {
-	return(-3);
-      }
+  oufs_path_iter_init(&it, path);
+  while(oufs_path_iter_next(&it, &name, &len)) {
+    ++n_components;
+    // Remember this name
+    oufs_copy_local_name(local_name, name, len);
+
+    // Fetch the inode that corresponds to the child
+    if(oufs_read_inode_by_reference(*child, &inode) != 0) {
+      return(-3);
+    }
 
-      // Check the type of the inode
-      if(inode.type != 'D') {
-	// Parent is not a directory
-	*parent = *child = UNALLOCATED_INODE;
-	return(-2);  // Not a valid directory
+    // Check the type of the inode
+    if(inode.type != IT_DIRECTORY) {
+      // Parent is not a directory
+      *parent = *child = UNALLOCATED_INODE;
+      return(-2);  // Not a valid directory
+    }
+
+    // Get the new inode that corresponds to the name by searching the current directory
+    INODE_REFERENCE new_inode = oufs_lookup_directory_element_n(*child, &inode, name, len);
+    *parent = *child;
+    *child = new_inode;
+    if(new_inode == UNALLOCATED_INODE) {
+      // name not found
+      //  Is there another (nontrivial) step in the path?
+      const char *rest;
+      size_t rest_len;
+      if(oufs_path_iter_next(&it, &rest, &rest_len)) {
+	// There are more sub-items - so the parent does not exist
+	*parent = UNALLOCATED_INODE;
       }
-      // Get the new inode that corresponds to the name by searching the current directory
-      INODE_REFERENCE new_inode = oufs_find_directory_element(&inode, directory_name);
-      grandparent = *parent;
-      *parent = *child;
-      *child = new_inode;
-      if(new_inode == UNALLOCATED_INODE) {
-	// name not found
-	//  Is there another (nontrivial) step in the path?
-	//  Loop until end or we have found a nontrivial name
-	do {
-	  directory_name = strtok(NULL, "/");
-	  if(directory_name != NULL && strlen(directory_name) >= FILE_NAME_SIZE-1) 
-	    // Truncate the name
-	    directory_name[FILE_NAME_SIZE - 1] = 0;
-	}while(directory_name != NULL && (strcmp(directory_name, "") == 0));
-	
-	if(directory_name != NULL) {
-	  // There are more sub-items - so the parent does not exist
-	  *parent = UNALLOCATED_INODE;
-	};
-	// Directory/file does not exist
-	return(-1);
-      };
+      // Directory/file does not exist
+      return(-1);
     }
-    // Go on to the next directory
-    directory_name = strtok(NULL, "/");
-    if(directory_name != NULL && strlen(directory_name) >= FILE_NAME_SIZE-1) 
-      // Truncate the name
-      directory_name[FILE_NAME_SIZE - 1] = 0;
-  };
+  }
 
-  // Item found.
-  if(*child == UNALLOCATED_INODE) {
-    // We went too far - roll back one step ***
-    *child = *parent;
-    *parent = grandparent;
+  if(n_components == 0 && start != 0) {
+    // The path names the start directory itself: its parent is its ..
+    if(oufs_read_inode_by_reference(start, &inode) != 0)
+      return(-3);
+    *parent = oufs_lookup_directory_element_n(start, &inode, "..", 2);
   }
+
   if(debug) {
     fprintf(stderr, "Found: %d, %d\n", *parent, *child);
   }
   // Success!
   return(0);
+}
+
+/**
+ *  Given a current working directory and either an absolute or relative path, find both the inode of the
+ * file or directory and the inode of the parent directory.  If one or both are not found, then they are
+ * set to UNALLOCATED_INODE.
+ *
+ *  This implementation handles a variety of strange cases, such as consecutive /'s and /'s at the end of
+ * of the path.  See oufs_find_file_at().
+ *
+ * @param cwd Absolute path for the current working directory
+ * @param path Absolute or relative path of the file/directory to be found
+ * @param parent Inode reference for the parent directory
+ * @param child  Inode reference for the file or directory specified by path
+ * @param local_name String name of the file or directory without any path information (i.e., name relative
+ *        to the parent)
+ * @return 0 if no errors
+ *         -1 if child not found
+ *         -x if an error
+ *
+ */
+int oufs_find_file(char *cwd, char * path, INODE_REFERENCE *parent, INODE_REFERENCE *child, char *local_name)
+{
+  OUFS_PATH_ITER it;
+  const char *name;
+  size_t len;
+  int ret;
 
+  if(path[0] == '/')
+    return(oufs_find_file_at(0, path, parent, child, local_name));
+
+  // A relative path with no components names the cwd itself
+  oufs_path_iter_init(&it, path);
+  if(!oufs_path_iter_next(&it, &name, &len))
+    return(oufs_find_file_at(0, cwd, parent, child, local_name));
+
+  // Resolve the cwd, then continue from there
+  INODE_REFERENCE cwd_parent, cwd_inode;
+  if((ret = oufs_find_file_at(0, cwd, &cwd_parent, &cwd_inode, NULL)) != 0) {
+    *parent = *child = UNALLOCATED_INODE;
+    return(ret == -1 ? -2 : ret);
+  }
+  return(oufs_find_file_at(cwd_inode, path, parent, child, local_name));
 }
 
 /**
@@ -662,6 +763,7 @@ INODE_REFERENCE oufs_allocate_new_inode()
 {
   BLOCK block;
   // Read the master block
+  pthread_mutex_lock(&oufs_master_lock);
   vdisk_read_block(MASTER_BLOCK_REFERENCE, &block);
 
   // Scan for an available block
@@ -679,6 +781,7 @@ INODE_REFERENCE oufs_allocate_new_inode()
   // Did we find a candidate byte in the table?
   if(flag == 1) {
     // No
+    pthread_mutex_unlock(&oufs_master_lock);
     if(debug)
       fprintf(stderr, "No blocks\n");
     return(UNALLOCATED_INODE);
@@ -693,6 +796,7 @@ INODE_REFERENCE oufs_allocate_new_inode()
 
   // Write out the updated master block
   vdisk_write_block(MASTER_BLOCK_REFERENCE, &block);
+  pthread_mutex_unlock(&oufs_master_lock);
 
   if(debug)
     fprintf(stderr, "Allocating block=%d (%d)\n", block_byte, block_bit);
@@ -700,6 +804,9 @@ INODE_REFERENCE oufs_allocate_new_inode()
   // Compute the block index
   INODE_REFERENCE block_reference = (block_byte << 3) + block_bit;
 
+  // Any filter left over from a previous owner of this inode is stale
+  oufs_bloom_invalidate(block_reference);
+
   if(debug)
     fprintf(stderr, "Allocating block=%d\n", block_reference);
   
@@ -710,163 +817,2473 @@ INODE_REFERENCE oufs_allocate_new_inode()
 }
 
 /**
-  * find a directory element 
-  * @param inode 
-  * @param direcotyr_name
-  */
-INODE_REFERENCE oufs_find_directory_element(INODE *inode, char *directory_name)
+ * Allocate several inodes with a single update of the inode allocation table
+ *
+ * @param n Number of inodes wanted
+ * @param refs Filled in with the allocated inodes (in increasing order)
+ * @return Number of inodes allocated: less than n if the table is full
+ */
+int oufs_allocate_new_inodes(int n, INODE_REFERENCE *refs)
 {
-    
-    BLOCK block;
-    memset(&block, 0, 256);
-    vdisk_read_block((*inode).data[0], &block);
-    // if the entry names and the directory names equals zero, then return them
-    for(int i = 0; i < DIRECTORY_ENTRIES_PER_BLOCK; i++)
-    {
-        if(strcmp(block.directory.entry[i].name, directory_name) == 0)
-        {
-            return block.directory.entry[i].inode_reference;
+  BLOCK block;
+  int count = 0;
 
-        }
+  if(n <= 0)
+    return(0);
+
+  // Read the master block
+  pthread_mutex_lock(&oufs_master_lock);
+  vdisk_read_block(MASTER_BLOCK_REFERENCE, &block);
+  unsigned char *flags = block.master.inode_allocated_flag;
+
+  // The lowest free inodes
+  for(int i = 0; i < N_INODES && count < n; ++i)
+    if(!(flags[i >> 3] & (1 << (i & 7)))) {
+      flags[i >> 3] |= (1 << (i & 7));
+      refs[count++] = i;
     }
-    return -1;
-    
-    
+  if(count > 0)
+    vdisk_write_block(MASTER_BLOCK_REFERENCE, &block);
+  pthread_mutex_unlock(&oufs_master_lock);
+
+  // Any filter left over from a previous owner of these inodes is stale
+  for(int i = 0; i < count; ++i)
+    oufs_bloom_invalidate(refs[i]);
+
+  if(debug)
+    fprintf(stderr, "Allocating %d inodes\n", count);
+
+  return(count);
 }
 
 /**
-  * write the inode by reference  
-  *
-  */
-int oufs_write_inode_by_reference(INODE_REFERENCE i, INODE *inode)
+ * Release an inode: clear its bit in the inode allocation table and reset it
+ * to an unused inode
+ *
+ * @param i Inode reference
+ */
+void oufs_deallocate_inode(INODE_REFERENCE i)
 {
+  BLOCK block;
+  INODE inode;
 
-    if(debug)
-        fprintf(stderr, "Fetching inode %d\n", i);
-  
-    // Find the address of the inode block and the inode within the block
-    BLOCK_REFERENCE block = i / INODES_PER_BLOCK + 1;
-    int element = (i % INODES_PER_BLOCK);
+  if(i >= N_INODES)
+    return;
 
-    BLOCK b;
-    if(vdisk_read_block(block, &b) == 0)
-    {
+  pthread_mutex_lock(&oufs_master_lock);
+  vdisk_read_block(MASTER_BLOCK_REFERENCE, &block);
+  block.master.inode_allocated_flag[i >> 3] &= ~(1 << (i & 7));
+  vdisk_write_block(MASTER_BLOCK_REFERENCE, &block);
+  pthread_mutex_unlock(&oufs_master_lock);
 
-        // Successfully loaded the block: copy just this inode
-        b.inodes.inode[element] = *inode;
-        vdisk_write_block(block, &b);
-        return(0);
-    }
-    // Error case
-  
-    return(-1);
-    
+  // Same state as a freshly formatted inode
+  memset(&inode, 0, sizeof(INODE));
+  inode.type = IT_NONE;
+  inode.n_references = 1;
+  for(int b = 0; b < BLOCKS_PER_INODE; ++b)
+    inode.data[b] = UNALLOCATED_BLOCK;
+  oufs_write_inode_by_reference(i, &inode);
+
+  oufs_bloom_invalidate(i);
 }
 
-OUFILE* oufs_fopen(char *cwd, char *path, char *mode)
+/**
+ * Release a data block: clear its bit in the block allocation table
+ *
+ * @param b Block reference
+ */
+void oufs_deallocate_block(BLOCK_REFERENCE b)
 {
-    //INODE_REFERENCE
+  BLOCK block;
 
+  if(b >= N_BLOCKS_IN_DISK)
+    return;
 
+  pthread_mutex_lock(&oufs_master_lock);
+  vdisk_read_block(MASTER_BLOCK_REFERENCE, &block);
+  block.master.block_allocated_flag[b >> 3] &= ~(1 << (b & 7));
+  vdisk_write_block(MASTER_BLOCK_REFERENCE, &block);
+  pthread_mutex_unlock(&oufs_master_lock);
+}
 
-    return NULL;
+/**********************************************************************/
+// Sorted directory blocks
+//
+// Every directory block is kept packed and sorted: the allocated entries
+// come first, in strictly increasing name order, followed by unallocated
+// entries.  The first block of a directory is the exception for its first
+// two slots, which always hold . and ..; its sorted region starts after
+// them.  Lookups can then binary search each block, listings can merge the
+// blocks instead of sorting, and removing an entry compacts its block.
+//
+// Older images may contain blocks with holes (left behind by an earlier
+// oufs_rmdir()); such blocks are searched linearly, and are sorted and
+// compacted the next time an entry is added to them.
 
+/**
+ * First slot of the sorted region of a directory block
+ *
+ * @param b Index of the block within the directory inode's data[] list
+ */
+static int oufs_directory_first_slot(int b)
+{
+  return(b == 0 ? 2 : 0);
 }
 
-// TODO: cite in README 
-//  https://www.tutorialspoint.com/c_standard_library/c_function_qsort.htm
-int cstring_cmp(const void *a, const void *b) 
-{ 
-    const char **ia = (const char **)a;
-    const char **ib = (const char **)b;
-    return strcmp(*ia, *ib);
-	/* strcmp functions works exactly as expected from
-	comparison function */ 
+/**
+ * Compare a directory entry's name with a (not null terminated) name
+ *
+ * @return <0, 0, >0 as for strcmp()
+ */
+static int oufs_entry_name_cmp(const DIRECTORY_ENTRY *entry, const char *name, size_t len)
+{
+  int c = strncmp(entry->name, name, len);
+  if(c == 0 && entry->name[len] != 0)
+    // The entry name is longer
+    c = 1;
+  return(c);
 }
 
-/*
- * list the files
- *
+/**
+ * Check that a directory block is packed and sorted
  *
+ * @param block The directory block
+ * @param first First slot of the sorted region
+ * @return 1 if the block is in sorted form, 0 otherwise
  */
-int oufs_list(char *cwd, char *path)
+int oufs_directory_block_is_sorted(const BLOCK *block, int first)
 {
-   
-    INODE_REFERENCE parent;
-    INODE_REFERENCE child;
-    char local_name[MAX_PATH_LENGTH];
-    // find the file
-    oufs_find_file(cwd, path, &parent, &child, local_name);
-
+  const DIRECTORY_ENTRY *entry = block->directory.entry;
+  int i;
 
+  for(i = first; i < DIRECTORY_ENTRIES_PER_BLOCK &&
+	entry[i].inode_reference != UNALLOCATED_INODE; ++i) {
+    if(i > first && strncmp(entry[i-1].name, entry[i].name, FILE_NAME_SIZE) >= 0)
+      return(0);
+  }
+  // No allocated entries after the first hole
+  for(; i < DIRECTORY_ENTRIES_PER_BLOCK; ++i) {
+    if(entry[i].inode_reference != UNALLOCATED_INODE)
+      return(0);
+  }
+  return(1);
+}
 
-    // read the inode and block
-    INODE ichild;
-    oufs_read_inode_by_reference(child, &ichild);
-    BLOCK block;
+/**
+ * Number of entries in the sorted region of a packed block (found by binary
+ * searching for the first unallocated slot)
+ *
+ * @param block The directory block (must be in sorted form)
+ * @param first First slot of the sorted region
+ * @return Index one past the last allocated entry
+ */
+static int oufs_directory_block_end(const BLOCK *block, int first)
+{
+  int lo = first;
+  int hi = DIRECTORY_ENTRIES_PER_BLOCK;
+
+  while(lo < hi) {
+    int mid = (lo + hi) / 2;
+    if(block->directory.entry[mid].inode_reference != UNALLOCATED_INODE)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return(lo);
+}
 
-    vdisk_read_block(ichild.data[0], &block);
+/**
+ * Binary search the sorted region of a packed directory block
+ *
+ * @param block The directory block (must be in sorted form)
+ * @param first First slot of the sorted region
+ * @param name Name to look for (need not be null terminated)
+ * @param len Length of name (at most FILE_NAME_SIZE-1)
+ * @param pos If not NULL, set to the slot where name is or would be inserted
+ * @return Slot index of the entry, or -1 if it is not in the block
+ */
+static int oufs_directory_block_search(const BLOCK *block, int first, const char *name,
+				       size_t len, int *pos)
+{
+  int lo = first;
+  int hi = oufs_directory_block_end(block, first);
+
+  while(lo < hi) {
+    int mid = (lo + hi) / 2;
+    int c = oufs_entry_name_cmp(&block->directory.entry[mid], name, len);
+    if(c == 0) {
+      if(pos != NULL)
+	*pos = mid;
+      return(mid);
+    }
+    if(c < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if(pos != NULL)
+    *pos = lo;
+  return(-1);
+}
 
-    int size = 0;
-    char *newArray[DIRECTORY_ENTRIES_PER_BLOCK];
-    // if inode reference is unallocated, then copy arrays
-    for(int i = 0; i < DIRECTORY_ENTRIES_PER_BLOCK; i++)
-    {
-        if(block.directory.entry[i].inode_reference != UNALLOCATED_INODE)
-        {
+/**
+ * qsort() comparator for directory entries: allocated entries first, in
+ * name order
+ */
+static int oufs_directory_entry_cmp(const void *a, const void *b)
+{
+  const DIRECTORY_ENTRY *ea = (const DIRECTORY_ENTRY *) a;
+  const DIRECTORY_ENTRY *eb = (const DIRECTORY_ENTRY *) b;
+  int ua = ea->inode_reference == UNALLOCATED_INODE;
+  int ub = eb->inode_reference == UNALLOCATED_INODE;
+
+  if(ua || ub)
+    return(ua - ub);
+  return(strncmp(ea->name, eb->name, FILE_NAME_SIZE));
+}
 
-            // copy into array; keep track
-            newArray[size] = block.directory.entry[i].name;
+/**
+ * Put a directory block into sorted form (in place)
+ *
+ * @param block The directory block
+ * @param first First slot of the sorted region
+ */
+static void oufs_directory_block_sort(BLOCK *block, int first)
+{
+  if(oufs_directory_block_is_sorted(block, first))
+    return;
+  qsort(&block->directory.entry[first], DIRECTORY_ENTRIES_PER_BLOCK - first,
+	sizeof(DIRECTORY_ENTRY), oufs_directory_entry_cmp);
+  for(int i = first; i < DIRECTORY_ENTRIES_PER_BLOCK; ++i) {
+    if(block->directory.entry[i].inode_reference == UNALLOCATED_INODE)
+      oufs_clean_directory_entry(&block->directory.entry[i]);
+  }
+}
+
+/**
+ * Search a directory for a name
+ *
+ * @param inode The directory inode
+ * @param name Name to look for (need not be null terminated)
+ * @param len Length of name
+ * @param sorted Non-zero if every block of the directory is known to be in sorted form
+ * @return The inode reference of the entry, or UNALLOCATED_INODE if it is not found
+ */
+static INODE_REFERENCE oufs_scan_directory(INODE *inode, const char *name, size_t len, int sorted)
+{
+  INODE_REFERENCE found = UNALLOCATED_INODE;
+  len = MIN(len, FILE_NAME_SIZE - 1);
+
+  // scan every block that belongs to the directory (pinned, not copied)
+  for(int b = 0; b < BLOCKS_PER_INODE && found == UNALLOCATED_INODE; ++b) {
+    if(inode->data[b] == UNALLOCATED_BLOCK)
+      continue;
+    const BLOCK *block = vdisk_pin_block(inode->data[b]);
+    if(block == NULL)
+      continue;
+
+    int first = 0;
+    if(sorted) {
+      // . and .. are outside of the sorted region
+      first = oufs_directory_first_slot(b);
+      int i = oufs_directory_block_search(block, first, name, len, NULL);
+      if(i >= 0)
+	found = block->directory.entry[i].inode_reference;
+    }
+
+    // Linear scan (only the fixed slots when the block is sorted)
+    int last = sorted ? first : DIRECTORY_ENTRIES_PER_BLOCK;
+    for(int i = 0; i < last && found == UNALLOCATED_INODE; ++i) {
+      const DIRECTORY_ENTRY *entry = &block->directory.entry[i];
+      if(entry->inode_reference != UNALLOCATED_INODE &&
+	 oufs_entry_name_cmp(entry, name, len) == 0)
+	found = entry->inode_reference;
+    }
+    vdisk_unpin_block(inode->data[b]);
+  }
+  return(found);
+}
+
+/**
+ * Find a name in a directory
+ *
+ * @param inode The directory inode
+ * @param name Name to look for (need not be null terminated)
+ * @param len Length of name; only the first FILE_NAME_SIZE-1 characters are significant
+ * @return The inode reference of the entry, or UNALLOCATED_INODE if it is not found
+ */
+INODE_REFERENCE oufs_find_directory_element_n(INODE *inode, const char *name, size_t len)
+{
+  return(oufs_scan_directory(inode, name, len, 0));
+}
+
+/**
+ * Add an entry to a directory.  The entry goes into the first block with a
+ * free slot, at its sorted position; a new directory block is allocated when
+ * all blocks are full.  The directory size is incremented and the directory
+ * inode is written back.
+ *
+ * @param dir_ref Inode reference of the directory
+ * @param dir The directory inode (updated)
+ * @param name Name of the new entry (null terminated; truncated to FILE_NAME_SIZE-1)
+ * @param ref Inode reference of the new entry
+ * @return 0 on success; -1 if the directory is full or the disk has no free blocks
+ */
+int oufs_directory_insert_entry(INODE_REFERENCE dir_ref, INODE *dir, const char *name,
+				INODE_REFERENCE ref)
+{
+  BLOCK block;
+  int b;
+  size_t len = strnlen(name, FILE_NAME_SIZE - 1);
+
+  for(b = 0; b < BLOCKS_PER_INODE; ++b) {
+    if(dir->data[b] == UNALLOCATED_BLOCK)
+      continue;
+    if(vdisk_read_block(dir->data[b], &block) != 0)
+      return(-1);
+    if(block.directory.entry[DIRECTORY_ENTRIES_PER_BLOCK - 1].inode_reference == UNALLOCATED_INODE ||
+       !oufs_directory_block_is_sorted(&block, oufs_directory_first_slot(b))) {
+      // May have room: bring into sorted form and check
+      oufs_directory_block_sort(&block, oufs_directory_first_slot(b));
+      if(block.directory.entry[DIRECTORY_ENTRIES_PER_BLOCK - 1].inode_reference == UNALLOCATED_INODE)
+	break;
+    }
+  }
+
+  if(b == BLOCKS_PER_INODE) {
+    // All blocks are full: add a block in the first unused slot
+    for(b = 0; b < BLOCKS_PER_INODE && dir->data[b] != UNALLOCATED_BLOCK; ++b);
+    if(b == BLOCKS_PER_INODE) {
+      fprintf(stderr, "Directory is full!\n");
+      return(-1);
+    }
+    BLOCK_REFERENCE new_block = oufs_allocate_new_block();
+    if(new_block == UNALLOCATED_BLOCK) {
+      fprintf(stderr, "All blocks are full!\n");
+      return(-1);
+    }
+    for(int i = 0; i < DIRECTORY_ENTRIES_PER_BLOCK; ++i)
+      oufs_clean_directory_entry(&block.directory.entry[i]);
+    dir->data[b] = new_block;
+  }
+
+  // Shift the larger names up by one slot and drop the new entry in
+  int first = oufs_directory_first_slot(b);
+  int pos;
+  oufs_directory_block_search(&block, first, name, len, &pos);
+  int end = oufs_directory_block_end(&block, first);
+  memmove(&block.directory.entry[pos + 1], &block.directory.entry[pos],
+	  (end - pos) * sizeof(DIRECTORY_ENTRY));
+  DIRECTORY_ENTRY *entry = &block.directory.entry[pos];
+  memset(entry->name, 0, FILE_NAME_SIZE);
+  memcpy(entry->name, name, len);
+  entry->inode_reference = ref;
+  vdisk_write_block(dir->data[b], &block);
+  oufs_bloom_add(dir_ref, entry->name);
+
+  dir->size++;
+  oufs_write_inode_by_reference(dir_ref, dir);
+  return(0);
+}
+
+/**
+ * Remove an entry from a directory, compacting its block.  A block other
+ * than the first that becomes empty is released.  The directory size is
+ * decremented and the directory inode is written back.
+ *
+ * @param dir_ref Inode reference of the directory
+ * @param dir The directory inode (updated)
+ * @param name Name of the entry (need not be null terminated)
+ * @param len Length of name
+ * @return The inode reference of the removed entry; UNALLOCATED_INODE if it was not found
+ */
+INODE_REFERENCE oufs_directory_remove_entry(INODE_REFERENCE dir_ref, INODE *dir,
+					    const char *name, size_t len)
+{
+  BLOCK block;
+  len = MIN(len, FILE_NAME_SIZE - 1);
+
+  for(int b = 0; b < BLOCKS_PER_INODE; ++b) {
+    if(dir->data[b] == UNALLOCATED_BLOCK)
+      continue;
+    if(vdisk_read_block(dir->data[b], &block) != 0)
+      continue;
+
+    // The fixed entries are never removed
+    int first = oufs_directory_first_slot(b);
+    oufs_directory_block_sort(&block, first);
+    int i = oufs_directory_block_search(&block, first, name, len, NULL);
+    if(i < 0)
+      continue;
+
+    INODE_REFERENCE ref = block.directory.entry[i].inode_reference;
+    int end = oufs_directory_block_end(&block, first);
+    memmove(&block.directory.entry[i], &block.directory.entry[i + 1],
+	    (end - i - 1) * sizeof(DIRECTORY_ENTRY));
+    oufs_clean_directory_entry(&block.directory.entry[end - 1]);
+
+    if(b != 0 && end - 1 == 0) {
+      // Block is now empty: give it back
+      oufs_deallocate_block(dir->data[b]);
+      dir->data[b] = UNALLOCATED_BLOCK;
+    }else{
+      vdisk_write_block(dir->data[b], &block);
+    }
+
+    dir->size--;
+    oufs_write_inode_by_reference(dir_ref, dir);
+    return(ref);
+  }
+  return(UNALLOCATED_INODE);
+}
+
+/**
+ * Point an existing directory entry at another inode, in place: one write of
+ * the block that holds it.  The fixed . and .. entries can be changed too.
+ *
+ * @param dir The directory inode
+ * @param name Name of the entry (need not be null terminated)
+ * @param len Length of name
+ * @param ref The new inode reference of the entry
+ * @return The entry's previous inode reference; UNALLOCATED_INODE if it was not found
+ */
+INODE_REFERENCE oufs_directory_replace_entry(INODE *dir, const char *name, size_t len,
+					     INODE_REFERENCE ref)
+{
+  BLOCK block;
+  len = MIN(len, FILE_NAME_SIZE - 1);
+
+  for(int b = 0; b < BLOCKS_PER_INODE; ++b) {
+    if(dir->data[b] == UNALLOCATED_BLOCK)
+      continue;
+    if(vdisk_read_block(dir->data[b], &block) != 0)
+      continue;
+
+    int first = oufs_directory_first_slot(b);
+    oufs_directory_block_sort(&block, first);
+    int i = oufs_directory_block_search(&block, first, name, len, NULL);
+    for(int j = 0; j < first && i < 0; ++j)
+      if(oufs_entry_name_cmp(&block.directory.entry[j], name, len) == 0)
+	i = j;
+    if(i < 0)
+      continue;
+
+    INODE_REFERENCE old = block.directory.entry[i].inode_reference;
+    block.directory.entry[i].inode_reference = ref;
+    vdisk_write_block(dir->data[b], &block);
+    return(old);
+  }
+  return(UNALLOCATED_INODE);
+}
+
+/**
+  * find a directory element 
+  * @param inode The directory inode
+  * @param directory_name Null terminated name to look for
+  * @return The inode reference of the entry, or UNALLOCATED_INODE if it is not found
+  */
+INODE_REFERENCE oufs_find_directory_element(INODE *inode, char *directory_name)
+{
+    return oufs_find_directory_element_n(inode, directory_name, strlen(directory_name));
+}
+
+/**********************************************************************/
+// Per-directory Bloom filters
+//
+// Each directory inode gets a small in-memory Bloom filter over the names
+// it contains.  The filter is built the first time the directory is
+// searched and is then kept up to date as names are added, so that a
+// lookup for a name that does not exist (the common case for every
+// create) can usually be answered without reading any directory blocks.
+// Removing a name leaves its bits set: this only costs a false positive.
+
+// Number of bits in each filter (must be a power of 2)
+#define BLOOM_BITS 512
+
+// Number of hash probes per name
+#define BLOOM_HASHES 3
+
+typedef struct oufs_bloom_s
+{
+  // Non-zero once the filter reflects the directory contents
+  int valid;
+  // Non-zero if every block of the directory was in sorted form when the
+  //  filter was built (blocks are only ever modified in sorted form)
+  int sorted;
+  unsigned char bits[BLOOM_BITS >> 3];
+} OUFS_BLOOM;
+
+// One filter per inode (only directory inodes are ever used)
+static OUFS_BLOOM bloom_cache[N_INODES];
+
+// Protects bloom_cache so that lookups may run in several threads
+static pthread_mutex_t bloom_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int oufs_bloom_query(INODE_REFERENCE dir, INODE *inode, const char *name, size_t len,
+			    int *sorted);
+
+/**
+ * Compute the two base hashes for a name.  Only the first FILE_NAME_SIZE-1
+ * characters are significant, matching the lookup rules of oufs_find_file_at().
+ *
+ * @param name Name to hash (need not be null terminated)
+ * @param len Length of name
+ * @param h1 First hash (FNV-1a)
+ * @param h2 Second hash (djb2), forced odd so that probes cover all bits
+ */
+static void oufs_bloom_hash(const char *name, size_t len, unsigned int *h1, unsigned int *h2)
+{
+  len = MIN(len, FILE_NAME_SIZE - 1);
+  *h1 = 2166136261u;
+  *h2 = 5381;
+  for(size_t i = 0; i < len; ++i) {
+    *h1 = (*h1 ^ (unsigned char) name[i]) * 16777619u;
+    *h2 = (*h2 << 5) + *h2 + (unsigned char) name[i];
+  }
+  *h2 |= 1;
+}
+
+/**
+ * Set the bits for a name.  bloom_lock must be held.
+ */
+static void oufs_bloom_set(INODE_REFERENCE dir, const char *name, size_t len)
+{
+  unsigned int h1, h2;
+  oufs_bloom_hash(name, len, &h1, &h2);
+  for(int i = 0; i < BLOOM_HASHES; ++i) {
+    unsigned int bit = (h1 + i * h2) & (BLOOM_BITS - 1);
+    bloom_cache[dir].bits[bit >> 3] |= (1 << (bit & 7));
+  }
+}
+
+/**
+ * Record a name in the filter of a directory.  Does nothing if the filter has
+ * not been built yet (it will pick the name up when it is).
+ *
+ * @param dir Inode reference of the directory
+ * @param name Name that has been added to the directory
+ */
+void oufs_bloom_add(INODE_REFERENCE dir, const char *name)
+{
+  if(dir >= N_INODES)
+    return;
+
+  pthread_mutex_lock(&bloom_lock);
+  if(bloom_cache[dir].valid)
+    oufs_bloom_set(dir, name, strnlen(name, FILE_NAME_SIZE));
+  pthread_mutex_unlock(&bloom_lock);
+}
+
+/**
+ * Forget the filter for one inode.  Must be called whenever the inode is
+ * (re)allocated or freed.
+ *
+ * @param dir Inode reference
+ */
+void oufs_bloom_invalidate(INODE_REFERENCE dir)
+{
+  if(dir >= N_INODES)
+    return;
+
+  pthread_mutex_lock(&bloom_lock);
+  bloom_cache[dir].valid = 0;
+  pthread_mutex_unlock(&bloom_lock);
+}
+
+/**
+ * Forget all filters (e.g., after the disk has been formatted)
+ */
+void oufs_bloom_reset()
+{
+  pthread_mutex_lock(&bloom_lock);
+  memset(bloom_cache, 0, sizeof(bloom_cache));
+  pthread_mutex_unlock(&bloom_lock);
+}
+
+/**
+ * Build the filter of a directory from its directory blocks.  bloom_lock
+ * must be held.
+ *
+ * @param dir Inode reference of the directory
+ * @param inode The directory inode
+ */
+static void oufs_bloom_build(INODE_REFERENCE dir, INODE *inode)
+{
+  memset(bloom_cache[dir].bits, 0, sizeof(bloom_cache[dir].bits));
+  bloom_cache[dir].sorted = 1;
+
+  for(int b = 0; b < BLOCKS_PER_INODE; ++b) {
+    if(inode->data[b] == UNALLOCATED_BLOCK)
+      continue;
+    const BLOCK *block = vdisk_pin_block(inode->data[b]);
+    if(block == NULL) {
+      // Cannot trust a partial filter
+      return;
+    }
+    if(!oufs_directory_block_is_sorted(block, oufs_directory_first_slot(b)))
+      bloom_cache[dir].sorted = 0;
+    for(int i = 0; i < DIRECTORY_ENTRIES_PER_BLOCK; ++i) {
+      const DIRECTORY_ENTRY *entry = &block->directory.entry[i];
+      if(entry->inode_reference != UNALLOCATED_INODE)
+	oufs_bloom_set(dir, entry->name, strnlen(entry->name, FILE_NAME_SIZE));
+    }
+    vdisk_unpin_block(inode->data[b]);
+  }
+  bloom_cache[dir].valid = 1;
+}
+
+/**
+ * Ask whether a directory may contain a name
+ *
+ * @param dir Inode reference of the directory
+ * @param inode The directory inode
+ * @param name Name to look for (need not be null terminated)
+ * @param len Length of name
+ * @return 0 if the name is definitely not in the directory
+ *         1 if the name may be in the directory
+ */
+int oufs_bloom_may_contain(INODE_REFERENCE dir, INODE *inode, const char *name, size_t len)
+{
+  return(oufs_bloom_query(dir, inode, name, len, NULL));
+}
+
+/**
+ * Ask whether a directory may contain a name, and whether its blocks are all
+ * in sorted form
+ *
+ * @param dir Inode reference of the directory
+ * @param inode The directory inode
+ * @param name Name to look for (need not be null terminated)
+ * @param len Length of name
+ * @param sorted If not NULL, set to 1 if the directory can be binary searched
+ * @return 0 if the name is definitely not in the directory
+ *         1 if the name may be in the directory
+ */
+static int oufs_bloom_query(INODE_REFERENCE dir, INODE *inode, const char *name, size_t len,
+			    int *sorted)
+{
+  int ret = 1;
+
+  if(sorted != NULL)
+    *sorted = 0;
+  if(dir >= N_INODES)
+    return(1);
+
+  pthread_mutex_lock(&bloom_lock);
+  if(!bloom_cache[dir].valid)
+    oufs_bloom_build(dir, inode);
+
+  if(bloom_cache[dir].valid) {
+    if(sorted != NULL)
+      *sorted = bloom_cache[dir].sorted;
+    unsigned int h1, h2;
+    oufs_bloom_hash(name, len, &h1, &h2);
+    for(int i = 0; i < BLOOM_HASHES; ++i) {
+      unsigned int bit = (h1 + i * h2) & (BLOOM_BITS - 1);
+      if(!(bloom_cache[dir].bits[bit >> 3] & (1 << (bit & 7)))) {
+	ret = 0;
+	break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&bloom_lock);
+  return(ret);
+}
+
+/**
+ * Find a name in a directory, consulting the directory's Bloom filter first
+ *
+ * @param dir Inode reference of the directory
+ * @param inode The directory inode
+ * @param name Name to look for (need not be null terminated)
+ * @param len Length of name
+ * @return The inode reference of the entry, or UNALLOCATED_INODE if it is not found
+ */
+INODE_REFERENCE oufs_lookup_directory_element_n(INODE_REFERENCE dir, INODE *inode,
+						const char *name, size_t len)
+{
+  int sorted;
+
+  if(!oufs_bloom_query(dir, inode, name, len, &sorted)) {
+    if(debug)
+      fprintf(stderr, "Bloom filter: %.*s not in %d\n", (int) len, name, dir);
+    return(UNALLOCATED_INODE);
+  }
+  return(oufs_scan_directory(inode, name, len, sorted));
+}
+
+/**
+ * Null terminated version of oufs_lookup_directory_element_n()
+ */
+INODE_REFERENCE oufs_lookup_directory_element(INODE_REFERENCE dir, INODE *inode, char *name)
+{
+  return(oufs_lookup_directory_element_n(dir, inode, name, strlen(name)));
+}
+
+/**
+  * write the inode by reference  
+  *
+  */
+int oufs_write_inode_by_reference(INODE_REFERENCE i, INODE *inode)
+{
+
+    if(debug)
+        fprintf(stderr, "Fetching inode %d\n", i);
+  
+    // Find the address of the inode block and the inode within the block
+    BLOCK_REFERENCE block = i / INODES_PER_BLOCK + 1;
+    int element = (i % INODES_PER_BLOCK);
+
+    BLOCK b;
+    if(vdisk_read_block(block, &b) == 0)
+    {
+
+        // Successfully loaded the block: copy just this inode
+        b.inodes.inode[element] = *inode;
+        vdisk_write_block(block, &b);
+        return(0);
+    }
+    // Error case
+  
+    return(-1);
+    
+}
+
+/**
+ * Write several inodes, reading and writing each inode block involved only
+ * once
+ *
+ * @param n Number of inodes
+ * @param refs Inode references
+ * @param inodes The inodes to write (inodes[k] goes to refs[k])
+ * @return 0 on success; -1 on error
+ */
+int oufs_write_inodes(int n, const INODE_REFERENCE *refs, const INODE *inodes)
+{
+  BLOCK b;
+  int ret = 0;
+
+  for(BLOCK_REFERENCE block = 1; block <= N_INODE_BLOCKS; ++block) {
+    int loaded = 0;
+    for(int k = 0; k < n; ++k) {
+      if(refs[k] / INODES_PER_BLOCK + 1 != block)
+	continue;
+      if(!loaded) {
+	if(vdisk_read_block(block, &b) != 0) {
+	  ret = -1;
+	  break;
+	}
+	loaded = 1;
+      }
+      b.inodes.inode[refs[k] % INODES_PER_BLOCK] = inodes[k];
+    }
+    if(loaded && vdisk_write_block(block, &b) != 0)
+      ret = -1;
+  }
+  return(ret);
+}
+
+/**********************************************************************/
+// Buffered file streams
+//
+// An open file keeps a copy of its inode and a write cache that can hold
+// every block of the file.  Writes land in the cache, so a run of small
+// writes to the same block costs a single block write when the cache is
+// flushed.  Allocation is delayed until then too: all cached blocks that
+// need a data block get one together, as one contiguous extent when the
+// disk has room for it, and go out with one vectored write per run.  A file
+// removed before it is flushed never touches the block allocation table.
+// Whole-block writes to blocks the file already owns skip the cache.  The
+// inode (size and block map) is only written back by
+// oufs_fflush()/oufs_fclose().
+//
+// Bytes past the end of the file are never trusted on disk: they read
+// back as zeros.  A file block that has no data block (UNALLOCATED_BLOCK)
+// also reads back as zeros.
+
+static void oufs_refresh_shared(OUFS_OPEN_INODE *node);
+
+/**
+ * Write the changed blocks of the cache back to the disk.  Blocks without
+ * a data block of their own (new, or shared with a clone) are allocated
+ * here, all at once.  When a shared block is copied, the inode is written
+ * straight away, so that the inode table never lists a block the file no
+ * longer uses.
+ *
+ * @param node Open file's shared state
+ * @return 0 on success; -1 if the disk is full (the blocks that did not fit
+ *         stay in the cache)
+ */
+static int oufs_flush_buffer(OUFS_OPEN_INODE *node)
+{
+  BLOCK_REFERENCE refs[BLOCKS_PER_INODE];
+  struct iovec iov[BLOCKS_PER_INODE];
+  int ret = 0;
+
+  if(node->dirty == 0)
+    return(0);
+
+  // A block that is no longer shared is written in place
+  if(node->dirty & node->shared)
+    oufs_refresh_shared(node);
+
+  // Delayed allocation
+  int n_missing = 0;
+  int copied = 0;
+  for(int i = 0; i < BLOCKS_PER_INODE; ++i)
+    if((node->dirty & (1 << i)) &&
+       (node->inode.data[i] == UNALLOCATED_BLOCK || node->shared & (1 << i)))
+      ++n_missing;
+  if(n_missing > 0) {
+    int n_allocated = oufs_allocate_new_blocks(n_missing, refs);
+    if(n_allocated < n_missing) {
+      fprintf(stderr, "All blocks are full!\n");
+      ret = -1;
+    }
+    int k = 0;
+    for(int i = 0; i < BLOCKS_PER_INODE && k < n_allocated; ++i) {
+      if((node->dirty & (1 << i)) &&
+	 (node->inode.data[i] == UNALLOCATED_BLOCK || node->shared & (1 << i))) {
+	// For a shared block, the cache holds the whole block: writing it to
+	// the new block is the copy
+	if(node->shared & (1 << i))
+	  copied = 1;
+	node->inode.data[i] = refs[k++];
+	node->shared &= ~(1 << i);
+      }
+    }
+    if(n_allocated > 0)
+      node->inode_dirty = 1;
+  }
+
+  // One vectored write per run of physically consecutive blocks
+  for(int i = 0, j; i < BLOCKS_PER_INODE; i = j) {
+    j = i + 1;
+    if(!(node->dirty & (1 << i)) || node->inode.data[i] == UNALLOCATED_BLOCK ||
+       node->shared & (1 << i))
+      continue;
+    iov[0].iov_base = &node->cache[i];
+    iov[0].iov_len = BLOCK_SIZE;
+    while(j < BLOCKS_PER_INODE && (node->dirty & (1 << j)) && !(node->shared & (1 << j)) &&
+	  node->inode.data[j] == node->inode.data[j - 1] + 1) {
+      iov[j - i].iov_base = &node->cache[j];
+      iov[j - i].iov_len = BLOCK_SIZE;
+      ++j;
+    }
+    if(vdisk_writev_blocks(node->inode.data[i], j - i, iov, j - i) != 0)
+      return(-1);
+    for(int k = i; k < j; ++k)
+      node->dirty &= ~(1 << k);
+  }
+  if(copied) {
+    // The clone is now the only user of the old blocks
+    oufs_write_inode_by_reference(node->inode_reference, &node->inode);
+    node->inode_dirty = 0;
+  }
+  return(ret);
+}
+
+/**
+ * Bring a block of the file into the cache
+ *
+ * @param fp Open file
+ * @param index Index of the block within the file
+ * @return The cached block; NULL on error
+ */
+static BLOCK *oufs_cache_block(OUFILE *fp, int index)
+{
+  OUFS_OPEN_INODE *node = fp->node;
+  BLOCK *b = &node->cache[index];
+
+  if(node->cached & (1 << index))
+    return(b);
+
+  BLOCK_REFERENCE ref = node->inode.data[index];
+  int start = index * BLOCK_SIZE;
+  if(ref == UNALLOCATED_BLOCK || start >= node->inode.size) {
+    memset(b, 0, BLOCK_SIZE);
+  }else{
+    if(vdisk_read_block(ref, b) != 0)
+      return(NULL);
+    if(node->inode.size - start < BLOCK_SIZE)
+      // Stale bytes past the end of the file
+      memset(&b->data.data[node->inode.size - start], 0, BLOCK_SIZE - (node->inode.size - start));
+  }
+  node->cached |= 1 << index;
+  return(b);
+}
+
+/**
+ * Before a write past the end of the file: the bytes between the end of the
+ * file and the end of its last block become part of the file, so they must
+ * be zeros on disk too
+ *
+ * @param fp Open file
+ * @return 0 on success; -1 on error
+ */
+static int oufs_zero_tail(OUFILE *fp)
+{
+  int index = fp->node->inode.size / BLOCK_SIZE;
+  int end = fp->node->inode.size % BLOCK_SIZE;
+
+  if(end == 0 || (fp->node->inode.data[index] == UNALLOCATED_BLOCK &&
+		  !(fp->node->cached & (1 << index))))
+    return(0);
+  BLOCK *b = oufs_cache_block(fp, index);
+  if(b == NULL)
+    return(-1);
+  // The cache may already have held the block (with bytes cut off by
+  // oufs_ftruncate())
+  memset(&b->data.data[end], 0, BLOCK_SIZE - end);
+  fp->node->dirty |= 1 << index;
+  return(0);
+}
+
+/**
+ * Fetch a block of a file for reading, through the readahead buffer.
+ *
+ * A miss on the block that directly follows the previous one means the
+ * reader is sequential: the window of blocks fetched in one batched read is
+ * doubled (up to the whole file).  Any other miss resets the window to a
+ * single block.
+ *
+ * @param fp Open file
+ * @param index Index of the block within the file
+ * @return Pointer to the block's data (valid until the next call); NULL on error
+ */
+static unsigned char *oufs_readahead_block(OUFILE *fp, int index)
+{
+  // Drop blocks fetched before the file last changed
+  if(fp->ra_generation != fp->node->generation) {
+    fp->ra_count = 0;
+    fp->ra_generation = fp->node->generation;
+  }
+
+  if(index < fp->ra_start || index >= fp->ra_start + fp->ra_count) {
+    // Miss
+    if(index == fp->ra_next)
+      fp->ra_window = MIN(2 * fp->ra_window, BLOCKS_PER_INODE);
+    else
+      fp->ra_window = 1;
+
+    // Never read past the last block of the file
+    int last = (fp->node->inode.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int count = MIN(fp->ra_window, MIN(last, BLOCKS_PER_INODE) - index);
+    if(count < 1)
+      count = 1;
+
+    // Batched read of each run of allocated blocks; holes read as zeros
+    int i = 0;
+    while(i < count) {
+      if(fp->node->inode.data[index + i] == UNALLOCATED_BLOCK) {
+	memset(&fp->ra_buffer[i], 0, BLOCK_SIZE);
+	++i;
+	continue;
+      }
+      int j = i + 1;
+      while(j < count && fp->node->inode.data[index + j] != UNALLOCATED_BLOCK)
+	++j;
+      if(vdisk_read_blocks(&fp->node->inode.data[index + i], j - i, &fp->ra_buffer[i]) != 0) {
+	fp->ra_count = 0;
+	return(NULL);
+      }
+      i = j;
+    }
+
+    // Stale bytes past the end of the file
+    int end = fp->node->inode.size - index * BLOCK_SIZE;
+    if(end < count * BLOCK_SIZE)
+      memset((unsigned char *) fp->ra_buffer + end, 0, count * BLOCK_SIZE - end);
+
+    fp->ra_start = index;
+    fp->ra_count = count;
+    if(debug)
+      fprintf(stderr, "Readahead: blocks %d..%d\n", index, index + count - 1);
+  }
+
+  fp->ra_next = index + 1;
+  return(fp->ra_buffer[index - fp->ra_start].data.data);
+}
+
+/**
+ * Count the inodes that reference each data block.  A block shared by
+ * clones has a count above 1 (hard links share the inode, so they count
+ * once).  The counts are not stored on disk: they come from one batched read
+ * of the inode table.
+ *
+ * @param counts Filled in: one count per block of the disk
+ * @return 0 on success; -1 on error
+ */
+int oufs_block_reference_counts(unsigned char *counts)
+{
+  BLOCK_REFERENCE refs[N_INODE_BLOCKS];
+  BLOCK blocks[N_INODE_BLOCKS];
+
+  for(int i = 0; i < N_INODE_BLOCKS; ++i)
+    refs[i] = i + 1;
+  if(vdisk_read_blocks(refs, N_INODE_BLOCKS, blocks) != 0)
+    return(-1);
+
+  memset(counts, 0, N_BLOCKS_IN_DISK);
+  for(int i = 0; i < N_INODES; ++i) {
+    INODE *inode = &blocks[i / INODES_PER_BLOCK].inodes.inode[i % INODES_PER_BLOCK];
+    if(inode->type == IT_NONE)
+      continue;
+    for(int j = 0; j < BLOCKS_PER_INODE; ++j)
+      if(inode->data[j] < N_BLOCKS_IN_DISK && counts[inode->data[j]] < 255)
+	counts[inode->data[j]]++;
+  }
+  return(0);
+}
+
+/**
+ * Find the blocks of a file that are shared with another inode
+ *
+ * @param inode The file's inode (as it is on disk)
+ * @return Bit i set if data[i] is shared
+ */
+static unsigned int oufs_shared_blocks(INODE *inode)
+{
+  unsigned char counts[N_BLOCKS_IN_DISK];
+  unsigned int shared = 0;
+
+  if(oufs_block_reference_counts(counts) != 0)
+    return(0);
+  for(int i = 0; i < BLOCKS_PER_INODE; ++i)
+    if(inode->data[i] != UNALLOCATED_BLOCK && counts[inode->data[i]] > 1)
+      shared |= 1 << i;
+  return(shared);
+}
+
+/**
+ * Bring an open file's shared bits up to date: since they were set, the
+ * clone may have been removed or truncated, or may have copied the block
+ * (the caller holds the write lock).  A bit is only ever set too often, so
+ * clearing the blocks no other inode uses is enough.
+ *
+ * @param node Open file's shared state
+ */
+static void oufs_refresh_shared(OUFS_OPEN_INODE *node)
+{
+  node->shared &= oufs_shared_blocks(&node->inode);
+}
+
+/**
+ * Release all data blocks of a file with one master block update, leaving
+ * the file empty (the inode is not written).  Blocks still used by a clone
+ * are only dropped from this file.
+ *
+ * @param inode The file's inode (updated)
+ * @param shared Bit i set if data[i] is shared
+ */
+static void oufs_free_file_blocks(INODE *inode, unsigned int shared)
+{
+  BLOCK block;
+  pthread_mutex_lock(&oufs_master_lock);
+  vdisk_read_block(MASTER_BLOCK_REFERENCE, &block);
+  for(int i = 0; i < BLOCKS_PER_INODE; ++i) {
+    BLOCK_REFERENCE b = inode->data[i];
+    if(b != UNALLOCATED_BLOCK && !(shared & (1 << i)))
+      block.master.block_allocated_flag[b >> 3] &= ~(1 << (b & 7));
+    inode->data[i] = UNALLOCATED_BLOCK;
+  }
+  vdisk_write_block(MASTER_BLOCK_REFERENCE, &block);
+  pthread_mutex_unlock(&oufs_master_lock);
+  inode->size = 0;
+}
+
+/**
+ * Release a file that has lost its last name: its inode, and the data
+ * blocks that no clone still uses, with one master block update
+ *
+ * @param i Inode reference
+ * @param inode The file's inode
+ */
+static void oufs_release_file(INODE_REFERENCE i, INODE *inode)
+{
+  unsigned int shared = oufs_shared_blocks(inode);
+  BLOCK block;
+
+  pthread_mutex_lock(&oufs_master_lock);
+  vdisk_read_block(MASTER_BLOCK_REFERENCE, &block);
+  block.master.inode_allocated_flag[i >> 3] &= ~(1 << (i & 7));
+  for(int j = 0; j < BLOCKS_PER_INODE; ++j) {
+    BLOCK_REFERENCE b = inode->data[j];
+    if(b != UNALLOCATED_BLOCK && !(shared & (1 << j)))
+      block.master.block_allocated_flag[b >> 3] &= ~(1 << (b & 7));
+    inode->data[j] = UNALLOCATED_BLOCK;
+  }
+  vdisk_write_block(MASTER_BLOCK_REFERENCE, &block);
+  pthread_mutex_unlock(&oufs_master_lock);
+
+  // Same state as a freshly formatted inode
+  inode->type = IT_NONE;
+  inode->n_references = 1;
+  inode->size = 0;
+  oufs_write_inode_by_reference(i, inode);
+}
+
+static int oufs_fwritev_locked(OUFILE *fp, const struct iovec *iov, int iovcnt);
+
+// Open-inode table: entry i holds the shared state of inode i while any
+// OUFILE has it open
+
+static OUFS_OPEN_INODE *oufs_open_inodes[N_INODES];
+static pthread_mutex_t oufs_open_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Find the shared state of an open file, loading it on the first open
+ *
+ * @param i Inode reference
+ * @return The entry, with one more reference; NULL if the inode is not a file
+ */
+static OUFS_OPEN_INODE *oufs_open_inode_get(INODE_REFERENCE i)
+{
+  pthread_mutex_lock(&oufs_open_lock);
+  OUFS_OPEN_INODE *node = oufs_open_inodes[i];
+  if(node == NULL) {
+    node = calloc(1, sizeof(OUFS_OPEN_INODE));
+    if(node == NULL || oufs_read_inode_by_reference(i, &node->inode) != 0 ||
+       node->inode.type != IT_FILE) {
+      pthread_mutex_unlock(&oufs_open_lock);
+      free(node);
+      return(NULL);
+    }
+    node->inode_reference = i;
+    node->shared = oufs_shared_blocks(&node->inode);
+    pthread_rwlock_init(&node->lock, NULL);
+    oufs_open_inodes[i] = node;
+  }
+  node->n_open++;
+  pthread_mutex_unlock(&oufs_open_lock);
+  return(node);
+}
+
+/**
+ * Find the shared state of a file if it is open
+ *
+ * @param i Inode reference
+ * @return The entry, with one more reference; NULL if the file is not open
+ */
+static OUFS_OPEN_INODE *oufs_open_inode_find(INODE_REFERENCE i)
+{
+  pthread_mutex_lock(&oufs_open_lock);
+  OUFS_OPEN_INODE *node = oufs_open_inodes[i];
+  if(node != NULL)
+    node->n_open++;
+  pthread_mutex_unlock(&oufs_open_lock);
+  return(node);
+}
+
+/**
+ * Drop a reference to an open file's shared state, releasing it with the
+ * last one
+ *
+ * @param node The entry
+ */
+static void oufs_open_inode_put(OUFS_OPEN_INODE *node)
+{
+  pthread_mutex_lock(&oufs_open_lock);
+  if(--node->n_open == 0) {
+    oufs_open_inodes[node->inode_reference] = NULL;
+    if(node->unlinked)
+      // Removed while open: released now that nobody uses it
+      oufs_release_file(node->inode_reference, &node->inode);
+    pthread_rwlock_destroy(&node->lock);
+    free(node);
+  }
+  pthread_mutex_unlock(&oufs_open_lock);
+}
+
+/**
+ * Take an open file's lock for reading.  Readers go to the disk, so a write
+ * cache holding changes is flushed first.
+ *
+ * @param fp Open file
+ * @return 0 with the lock held; -1 (lock not held) if the changes cannot be
+ *         flushed because the disk is full
+ */
+static int oufs_lock_read(OUFILE *fp)
+{
+  for(;;) {
+    pthread_rwlock_rdlock(&fp->node->lock);
+    if(fp->node->dirty == 0)
+      return(0);
+    pthread_rwlock_unlock(&fp->node->lock);
+    pthread_rwlock_wrlock(&fp->node->lock);
+    int ret = oufs_flush_buffer(fp->node);
+    pthread_rwlock_unlock(&fp->node->lock);
+    if(ret != 0)
+      // What is on disk is not the file's contents; retrying would not help
+      return(-1);
+  }
+}
+
+/**
+ * Take an open file's lock for writing
+ *
+ * @param fp Open file
+ */
+static void oufs_lock_write(OUFILE *fp)
+{
+  pthread_rwlock_wrlock(&fp->node->lock);
+}
+
+/**
+ * Release an open file's lock
+ *
+ * @param fp Open file
+ */
+static void oufs_unlock(OUFILE *fp)
+{
+  pthread_rwlock_unlock(&fp->node->lock);
+}
+
+/**
+ * Write the buffer and the inode back to the disk (the caller holds the
+ * write lock)
+ *
+ * @param node Open file's shared state
+ * @return 0 on success; -1 on error
+ */
+static int oufs_flush_open_inode(OUFS_OPEN_INODE *node)
+{
+  int ret = oufs_flush_buffer(node);
+  if(node->inode_dirty) {
+    oufs_write_inode_by_reference(node->inode_reference, &node->inode);
+    node->inode_dirty = 0;
+  }
+  return(ret);
+}
+
+/**
+ * Open a file.  Opening a file that is already open (in this process)
+ * shares its inode, block map and write buffer with the other OUFILEs.
+ *
+ * @param cwd Absolute path representing the current working directory
+ * @param path Absolute or relative path to the file
+ * @param mode "r": read from the start of the file
+ *             "w": create the file, or truncate it if it exists
+ *             "a": create the file if needed; every write appends to the end
+ * @return An open file; NULL on error
+ */
+OUFILE* oufs_fopen(char *cwd, char *path, char *mode)
+{
+  INODE_REFERENCE parent;
+  INODE_REFERENCE child;
+  char local_name[MAX_PATH_LENGTH];
+  int ret;
+
+  if(mode == NULL || (mode[0] != 'r' && mode[0] != 'w' && mode[0] != 'a')) {
+    fprintf(stderr, "oufs_fopen(): bad mode\n");
+    return(NULL);
+  }
+
+  if((ret = oufs_find_file(cwd, path, &parent, &child, local_name)) < -1 ||
+     parent == UNALLOCATED_INODE) {
+    fprintf(stderr, "%s: not found\n", path);
+    return(NULL);
+  }
+
+  if(child == UNALLOCATED_INODE) {
+    // Does not exist: create it unless we are reading
+    if(mode[0] == 'r') {
+      fprintf(stderr, "%s: not found\n", path);
+      return(NULL);
+    }
+    if((child = oufs_create_file(parent, local_name)) == UNALLOCATED_INODE)
+      return(NULL);
+  }
+
+  OUFILE *fp = malloc(sizeof(OUFILE));
+  if(fp == NULL)
+    return(NULL);
+  if((fp->node = oufs_open_inode_get(child)) == NULL) {
+    fprintf(stderr, "%s: not a file\n", path);
+    free(fp);
+    return(NULL);
+  }
+  fp->mode = mode[0];
+  fp->offset = 0;
+  fp->ra_start = 0;
+  fp->ra_count = 0;
+  fp->ra_next = 0;
+  fp->ra_window = 1;
+  fp->ra_generation = 0;
+  fp->pinned = UNALLOCATED_BLOCK;
+
+  if(fp->mode == 'w') {
+    oufs_lock_write(fp);
+    if(fp->node->inode.size > 0) {
+      // Truncate now (along with anything still cached)
+      fp->node->cached = 0;
+      fp->node->dirty = 0;
+      oufs_refresh_shared(fp->node);
+      oufs_free_file_blocks(&fp->node->inode, fp->node->shared);
+      fp->node->shared = 0;
+      fp->node->generation++;
+      oufs_write_inode_by_reference(child, &fp->node->inode);
+      fp->node->inode_dirty = 0;
+    }
+    oufs_unlock(fp);
+  }
+  return(fp);
+}
+
+/**
+ * Write buffered changes to the disk: the data block in the buffer first,
+ * then the inode (once, no matter how many writes came before)
+ *
+ * @param fp Open file
+ * @return 0 on success; -1 on error
+ */
+int oufs_fflush(OUFILE *fp)
+{
+  if(fp == NULL)
+    return(-1);
+  oufs_lock_write(fp);
+  int ret = oufs_flush_open_inode(fp->node);
+  oufs_unlock(fp);
+  return(ret);
+}
+
+/**
+ * Flush and close a file.  The file is closed even if the flush fails.
+ *
+ * @param fp Open file
+ * @return 0 on success; -1 if buffered changes could not be written (with
+ *         delayed allocation, this is when a full disk is found)
+ */
+int oufs_fclose(OUFILE *fp)
+{
+  int ret = 0;
+
+  if(fp == NULL)
+    return(-1);
+  oufs_lock_write(fp);
+  // A removed file is not flushed: nobody can open it again
+  if(!fp->node->unlinked)
+    ret = oufs_flush_open_inode(fp->node);
+  oufs_unlock(fp);
+  if(fp->pinned != UNALLOCATED_BLOCK)
+    vdisk_unpin_block(fp->pinned);
+  oufs_open_inode_put(fp->node);
+  free(fp);
+  return(ret);
+}
+
+/**
+ * Write to a file at its current offset (at the end for mode "a")
+ *
+ * @param fp Open file (mode "w" or "a")
+ * @param buf Bytes to write
+ * @param len Number of bytes
+ * @return Number of bytes written (less than len if the file reached its
+ *         maximum size or the disk is full); -1 on error
+ */
+static int oufs_fwrite_locked(OUFILE *fp, unsigned char * buf, int len)
+{
+  if(fp == NULL || fp->mode == 'r')
+    return(-1);
+  if(fp->mode == 'a')
+    fp->offset = fp->node->inode.size;
+  else if(fp->offset > fp->node->inode.size && oufs_zero_tail(fp) != 0)
+    return(-1);
+
+  // Large write (covers at least one whole block): whole blocks the file
+  // already owns can go straight to the disk
+  if(len - (BLOCK_SIZE - fp->offset % BLOCK_SIZE) % BLOCK_SIZE >= BLOCK_SIZE) {
+    struct iovec iov = {buf, len};
+    return(oufs_fwritev_locked(fp, &iov, 1));
+  }
+
+  int done = 0;
+  while(done < len) {
+    int index = fp->offset / BLOCK_SIZE;
+    if(index >= BLOCKS_PER_INODE)
+      // File is at its maximum size
+      break;
+    BLOCK *b = oufs_cache_block(fp, index);
+    if(b == NULL)
+      break;
+
+    int in_block = fp->offset % BLOCK_SIZE;
+    int n = MIN(len - done, BLOCK_SIZE - in_block);
+    memcpy(&b->data.data[in_block], buf + done, n);
+    fp->node->dirty |= 1 << index;
+    done += n;
+    fp->offset += n;
+    if(fp->offset > fp->node->inode.size) {
+      fp->node->inode.size = fp->offset;
+      fp->node->inode_dirty = 1;
+    }
+  }
+  return(done);
+}
+
+/**
+ * Read from a file at its current offset
+ *
+ * @param fp Open file (mode "r")
+ * @param buf Buffer to read into
+ * @param len Maximum number of bytes
+ * @return Number of bytes read (0 at the end of the file); -1 on error
+ */
+static int oufs_fread_locked(OUFILE *fp, unsigned char * buf, int len)
+{
+  if(fp == NULL || fp->mode != 'r')
+    return(-1);
+
+  int done = 0;
+  while(done < len && fp->offset < fp->node->inode.size) {
+    int index = fp->offset / BLOCK_SIZE;
+    unsigned char *data = oufs_readahead_block(fp, index);
+    if(data == NULL)
+      return(done > 0 ? done : -1);
+
+    int in_block = fp->offset % BLOCK_SIZE;
+    int n = MIN(len - done, BLOCK_SIZE - in_block);
+    n = MIN(n, (int) fp->node->inode.size - fp->offset);
+    memcpy(buf + done, &data[in_block], n);
+    done += n;
+    fp->offset += n;
+  }
+  return(done);
+}
+
+/**
+ * Move the offset of a file.  Seeking past the end of the file is allowed:
+ * a later write leaves a hole, whose blocks are not allocated and read back
+ * as zeros.  In mode "a", writes still go to the end of the file.
+ *
+ * @param fp Open file
+ * @param offset Offset relative to whence
+ * @param whence SEEK_SET, SEEK_CUR or SEEK_END
+ * @return 0 on success; -1 if the new offset is out of range
+ */
+int oufs_fseek(OUFILE *fp, long offset, int whence)
+{
+  long base;
+
+  if(fp == NULL)
+    return(-1);
+  switch(whence) {
+  case SEEK_SET:
+    base = 0;
+    break;
+  case SEEK_CUR:
+    base = fp->offset;
+    break;
+  case SEEK_END:
+    pthread_rwlock_rdlock(&fp->node->lock);
+    base = fp->node->inode.size;
+    pthread_rwlock_unlock(&fp->node->lock);
+    break;
+  default:
+    return(-1);
+  }
+  if(base + offset < 0 || base + offset > BLOCKS_PER_INODE * BLOCK_SIZE)
+    return(-1);
+  fp->offset = base + offset;
+  return(0);
+}
+
+/**
+ * Current offset of a file
+ *
+ * @param fp Open file
+ * @return The offset; -1 on error
+ */
+long oufs_ftell(OUFILE *fp)
+{
+  if(fp == NULL)
+    return(-1);
+  return(fp->offset);
+}
+
+/**
+ * Reserve data blocks for a range of a file, contiguously when the disk has
+ * room for that, so that later writes to the range need no allocation.  The
+ * size of the file does not change; the reserved blocks read as zeros.
+ *
+ * @param fp Open file (mode "w" or "a")
+ * @param offset Start of the range
+ * @param len Length of the range
+ * @return 0 on success; -1 on error (nothing is reserved if the disk is full)
+ */
+static int oufs_fallocate_locked(OUFILE *fp, int offset, int len)
+{
+  static BLOCK zeros;
+  BLOCK_REFERENCE refs[BLOCKS_PER_INODE];
+  struct iovec iov[BLOCKS_PER_INODE];
+
+  if(fp == NULL || fp->mode == 'r' || offset < 0 || len < 0 ||
+     offset + len > BLOCKS_PER_INODE * BLOCK_SIZE)
+    return(-1);
+  if(len == 0)
+    return(0);
+
+  int first = offset / BLOCK_SIZE;
+  int last = (offset + len - 1) / BLOCK_SIZE;
+  int n_missing = 0;
+  for(int index = first; index <= last; ++index)
+    if(fp->node->inode.data[index] == UNALLOCATED_BLOCK)
+      ++n_missing;
+  if(n_missing == 0)
+    return(0);
+
+  int n_allocated = oufs_allocate_new_blocks(n_missing, refs);
+  if(n_allocated < n_missing) {
+    // All or nothing: give back what we got
+    if(n_allocated > 0) {
+      BLOCK block;
+      pthread_mutex_lock(&oufs_master_lock);
+      vdisk_read_block(MASTER_BLOCK_REFERENCE, &block);
+      for(int i = 0; i < n_allocated; ++i)
+	block.master.block_allocated_flag[refs[i] >> 3] &= ~(1 << (refs[i] & 7));
+      vdisk_write_block(MASTER_BLOCK_REFERENCE, &block);
+      pthread_mutex_unlock(&oufs_master_lock);
+    }
+    fprintf(stderr, "All blocks are full!\n");
+    return(-1);
+  }
+
+  // Clear the new blocks, one vectored write per run of consecutive blocks
+  for(int i = 0; i < n_allocated; ++i) {
+    iov[i].iov_base = &zeros;
+    iov[i].iov_len = BLOCK_SIZE;
+  }
+  for(int i = 0, j; i < n_allocated; i = j) {
+    for(j = i + 1; j < n_allocated && refs[j] == refs[j - 1] + 1; ++j);
+    if(vdisk_writev_blocks(refs[i], j - i, iov, j - i) != 0)
+      return(-1);
+  }
+
+  int k = 0;
+  for(int index = first; index <= last; ++index)
+    if(fp->node->inode.data[index] == UNALLOCATED_BLOCK)
+      fp->node->inode.data[index] = refs[k++];
+  fp->node->inode_dirty = 1;
+  return(0);
+}
+
+/**
+ * Set the size of a file.  Shrinking releases every block past the new end
+ * of the file with one update of the block allocation table; growing leaves
+ * a hole that reads as zeros.
+ *
+ * @param fp Open file (mode "w" or "a")
+ * @param length New size in bytes
+ * @return 0 on success; -1 on error
+ */
+static int oufs_ftruncate_locked(OUFILE *fp, int length)
+{
+  if(fp == NULL || fp->mode == 'r' || length < 0 || length > BLOCKS_PER_INODE * BLOCK_SIZE)
+    return(-1);
+
+  int changed = 0;
+  if(length > (int) fp->node->inode.size) {
+    if(oufs_zero_tail(fp) != 0)
+      return(-1);
+  }else{
+    int keep = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    // Cached blocks past the new end are dropped, changes and all
+    fp->node->cached &= (1 << keep) - 1;
+    fp->node->dirty &= (1 << keep) - 1;
+
+    BLOCK block;
+    oufs_refresh_shared(fp->node);
+    pthread_mutex_lock(&oufs_master_lock);
+    vdisk_read_block(MASTER_BLOCK_REFERENCE, &block);
+    for(int i = keep; i < BLOCKS_PER_INODE; ++i) {
+      BLOCK_REFERENCE b = fp->node->inode.data[i];
+      if(b == UNALLOCATED_BLOCK)
+	continue;
+      // A block shared with a clone stays allocated for the clone
+      if(!(fp->node->shared & (1 << i)))
+	block.master.block_allocated_flag[b >> 3] &= ~(1 << (b & 7));
+      fp->node->inode.data[i] = UNALLOCATED_BLOCK;
+      fp->node->shared &= ~(1 << i);
+      changed = 1;
+    }
+    if(changed)
+      vdisk_write_block(MASTER_BLOCK_REFERENCE, &block);
+    pthread_mutex_unlock(&oufs_master_lock);
+  }
+
+  fp->node->inode.size = length;
+  fp->node->inode_dirty = 1;
+  if(changed) {
+    // The freed blocks may be handed out at once: the inode must not list
+    // them any more
+    oufs_write_inode_by_reference(fp->node->inode_reference, &fp->node->inode);
+    fp->node->inode_dirty = 0;
+  }
+  return(0);
+}
+
+/**
+ * Zero-copy read: rather than copying into a caller's buffer, hand back a
+ * pointer to the file's data in the pinned disk block.  At most the rest of
+ * the current block is returned per call.
+ *
+ * @param fp Open file (mode "r")
+ * @param data Set to the data; valid until the next call on fp or oufs_fclose()
+ * @param len Maximum number of bytes
+ * @return Number of bytes available at *data (0 at the end of the file); -1 on error
+ */
+static int oufs_fread_zerocopy_locked(OUFILE *fp, const unsigned char **data, int len)
+{
+  // What holes read as
+  static const unsigned char zeros[BLOCK_SIZE];
+
+  if(fp == NULL || fp->mode != 'r')
+    return(-1);
+
+  // The previous pointer is no longer needed
+  if(fp->pinned != UNALLOCATED_BLOCK) {
+    vdisk_unpin_block(fp->pinned);
+    fp->pinned = UNALLOCATED_BLOCK;
+  }
+  if(fp->offset >= fp->node->inode.size || len <= 0)
+    return(0);
+
+  int index = fp->offset / BLOCK_SIZE;
+  int in_block = fp->offset % BLOCK_SIZE;
+  int n = MIN(len, BLOCK_SIZE - in_block);
+  n = MIN(n, (int) fp->node->inode.size - fp->offset);
+
+  BLOCK_REFERENCE ref = fp->node->inode.data[index];
+  if(ref == UNALLOCATED_BLOCK) {
+    *data = zeros + in_block;
+  }else{
+    const unsigned char *block = vdisk_pin_block(ref);
+    if(block == NULL)
+      return(-1);
+    fp->pinned = ref;
+    *data = block + in_block;
+  }
+  fp->offset += n;
+  return(n);
+}
+
+/**********************************************************************/
+// Scatter-gather file I/O
+//
+// oufs_freadv() maps a file range onto its data blocks and moves the bytes
+// straight from the disk into the caller's buffers: whole blocks are
+// transferred in place, and each run of physically consecutive blocks takes
+// one vectored vdisk call.  Only a partial block at either end of the range
+// goes through a bounce buffer.  oufs_fwritev() does the same for whole
+// blocks the file already owns; the rest goes through the write cache.
+
+// Most buffers handed to a single vectored vdisk call
+#define OUFS_IOV_BATCH 1024
+
+// Position within a list of caller buffers
+typedef struct oufs_iov_cursor_s
+{
+  const struct iovec *iov;
+  int iovcnt;
+  int index;
+  size_t offset;
+} OUFS_IOV_CURSOR;
+
+/**
+ * Describe the next n bytes of the caller's buffers as a list of pieces and
+ * advance past them
+ *
+ * @param c Cursor
+ * @param n Number of bytes
+ * @param out Pieces
+ * @param max Room in out
+ * @return Number of pieces; -1 if out is too small or the buffers run out
+ */
+static int oufs_iov_take(OUFS_IOV_CURSOR *c, size_t n, struct iovec *out, int max)
+{
+  int k = 0;
+
+  while(n > 0) {
+    if(c->index >= c->iovcnt || k == max)
+      return(-1);
+    size_t avail = c->iov[c->index].iov_len - c->offset;
+    if(avail == 0) {
+      c->index++;
+      c->offset = 0;
+      continue;
+    }
+    size_t m = MIN(avail, n);
+    out[k].iov_base = (char *) c->iov[c->index].iov_base + c->offset;
+    out[k].iov_len = m;
+    ++k;
+    c->offset += m;
+    n -= m;
+  }
+  return(k);
+}
+
+/**
+ * Copy n bytes between a flat buffer and the caller's buffers, advancing
+ * the cursor
+ *
+ * @param c Cursor
+ * @param buf Flat buffer (NULL: just skip n bytes)
+ * @param n Number of bytes
+ * @param to_user Non-zero to copy buf into the caller's buffers, zero for the reverse
+ */
+static void oufs_iov_copy(OUFS_IOV_CURSOR *c, unsigned char *buf, size_t n, int to_user)
+{
+  while(n > 0 && c->index < c->iovcnt) {
+    size_t avail = c->iov[c->index].iov_len - c->offset;
+    if(avail == 0) {
+      c->index++;
+      c->offset = 0;
+      continue;
+    }
+    size_t m = MIN(avail, n);
+    if(buf != NULL) {
+      char *p = (char *) c->iov[c->index].iov_base + c->offset;
+      if(to_user)
+	memcpy(p, buf, m);
+      else
+	memcpy(buf, p, m);
+      buf += m;
+    }
+    c->offset += m;
+    n -= m;
+  }
+}
+
+// A run of physically consecutive blocks being assembled for one vdisk call
+typedef struct oufs_io_run_s
+{
+  BLOCK_REFERENCE start;
+  int n_blocks;
+  int nvec;
+  struct iovec vec[OUFS_IOV_BATCH];
+} OUFS_IO_RUN;
+
+/**
+ * Issue the vectored vdisk call for a run and empty it
+ *
+ * @return 0 on success; <0 on error
+ */
+static int oufs_io_run_flush(OUFS_IO_RUN *run, int writing)
+{
+  int ret = 0;
+
+  if(run->n_blocks > 0) {
+    if(writing)
+      ret = vdisk_writev_blocks(run->start, run->n_blocks, run->vec, run->nvec);
+    else
+      ret = vdisk_readv_blocks(run->start, run->n_blocks, run->vec, run->nvec);
+  }
+  run->n_blocks = 0;
+  run->nvec = 0;
+  return(ret);
+}
+
+/**
+ * Add one block to a run, starting a new run if it does not follow on
+ *
+ * @param run Run
+ * @param ref Disk block
+ * @param vec Pieces covering the whole block
+ * @param nvec Number of pieces
+ * @param writing Direction of the transfer
+ * @return 0 on success; <0 on error
+ */
+static int oufs_io_run_add(OUFS_IO_RUN *run, BLOCK_REFERENCE ref, struct iovec *vec, int nvec,
+			   int writing)
+{
+  if(run->n_blocks > 0 &&
+     (ref != run->start + run->n_blocks || run->nvec + nvec > OUFS_IOV_BATCH)) {
+    int ret = oufs_io_run_flush(run, writing);
+    if(ret != 0)
+      return(ret);
+  }
+  if(run->n_blocks == 0)
+    run->start = ref;
+  memcpy(&run->vec[run->nvec], vec, nvec * sizeof(struct iovec));
+  run->nvec += nvec;
+  run->n_blocks++;
+  return(0);
+}
+
+/**
+ * Read total bytes from the file (at its offset) into the caller's buffers
+ *
+ * @param fp Open file
+ * @param c Cursor over the caller's buffers
+ * @param total Number of bytes (> 0, already clamped to the end of the file)
+ * @return 0 on success; <0 on error
+ */
+static int oufs_read_v(OUFILE *fp, OUFS_IOV_CURSOR *c, int total)
+{
+  // What holes read as
+  static unsigned char zeros[BLOCK_SIZE];
+  struct iovec vec[BLOCK_SIZE];
+  // Bounce buffers for a partial first [0] and last [1] block, and where
+  // their bytes go once they have been read
+  BLOCK bounce[2];
+  OUFS_IOV_CURSOR partial_cursor[2];
+  int partial_lo[2];
+  int partial_len[2] = {0, 0};
+  int first = fp->offset / BLOCK_SIZE;
+  int last = (fp->offset + total - 1) / BLOCK_SIZE;
+  int ret = 0;
+
+  OUFS_IO_RUN *run = malloc(sizeof(OUFS_IO_RUN));
+  if(run == NULL)
+    return(-1);
+  run->n_blocks = 0;
+  run->nvec = 0;
+
+  for(int index = first; index <= last && ret == 0; ++index) {
+    int lo = (index == first) ? fp->offset % BLOCK_SIZE : 0;
+    int hi = (index == last) ? (fp->offset + total - 1) % BLOCK_SIZE + 1 : BLOCK_SIZE;
+    BLOCK_REFERENCE ref = fp->node->inode.data[index];
+
+    if(ref == UNALLOCATED_BLOCK) {
+      // Reading a hole: zeros, and the run is broken
+      ret = oufs_io_run_flush(run, 0);
+      oufs_iov_copy(c, zeros, hi - lo, 1);
+      continue;
+    }
+
+    if(hi - lo < BLOCK_SIZE) {
+      // Partial block: read the whole block into a bounce buffer
+      int which = (index == first) ? 0 : 1;
+      partial_cursor[which] = *c;
+      partial_lo[which] = lo;
+      partial_len[which] = hi - lo;
+      oufs_iov_copy(c, NULL, hi - lo, 0);
+      vec[0].iov_base = &bounce[which];
+      vec[0].iov_len = BLOCK_SIZE;
+      ret = oufs_io_run_add(run, ref, vec, 1, 0);
+    }else{
+      // Whole block: straight into the caller's buffers
+      int nvec = oufs_iov_take(c, BLOCK_SIZE, vec, BLOCK_SIZE);
+      if(nvec < 0)
+	ret = -1;
+      else
+	ret = oufs_io_run_add(run, ref, vec, nvec, 0);
+    }
+  }
+  if(ret == 0)
+    ret = oufs_io_run_flush(run, 0);
+  free(run);
+
+  // Hand out the bytes of partially read blocks
+  for(int which = 0; which < 2 && ret == 0; ++which) {
+    if(partial_len[which] > 0)
+      oufs_iov_copy(&partial_cursor[which], &bounce[which].data.data[partial_lo[which]],
+		    partial_len[which], 1);
+  }
+  return(ret);
+}
+
+/**
+ * Total length of a list of buffers
+ */
+static size_t oufs_iov_length(const struct iovec *iov, int iovcnt)
+{
+  size_t total = 0;
+  for(int i = 0; i < iovcnt; ++i)
+    total += iov[i].iov_len;
+  return(total);
+}
+
+/**
+ * Read from a file at its current offset into several buffers (filled in
+ * order)
+ *
+ * @param fp Open file (mode "r")
+ * @param iov Buffers
+ * @param iovcnt Number of buffers
+ * @return Number of bytes read (0 at the end of the file); -1 on error
+ */
+static int oufs_freadv_locked(OUFILE *fp, const struct iovec *iov, int iovcnt)
+{
+  OUFS_IOV_CURSOR c = {iov, iovcnt, 0, 0};
+
+  if(fp == NULL || fp->mode != 'r' || iovcnt < 0)
+    return(-1);
+
+  size_t total = oufs_iov_length(iov, iovcnt);
+  if(fp->offset >= fp->node->inode.size)
+    return(0);
+  total = MIN(total, (size_t) (fp->node->inode.size - fp->offset));
+  if(total == 0)
+    return(0);
+
+  if(oufs_read_v(fp, &c, total) != 0)
+    return(-1);
+  fp->offset += total;
+  return(total);
+}
+
+/**
+ * Write several buffers (in order) to a file at its current offset (at the
+ * end for mode "a").  Whole blocks that the file already owns (and does not
+ * share with a clone) go straight from the caller's buffers to the disk,
+ * one vectored write per run of consecutive blocks; everything else lands
+ * in the write cache, to be allocated and written by oufs_fflush() or
+ * oufs_fclose(), which also commit the inode.
+ *
+ * @param fp Open file (mode "w" or "a")
+ * @param iov Buffers
+ * @param iovcnt Number of buffers
+ * @return Number of bytes written (less than requested if the file reached
+ *         its maximum size); -1 on error
+ */
+static int oufs_fwritev_locked(OUFILE *fp, const struct iovec *iov, int iovcnt)
+{
+  OUFS_IOV_CURSOR c = {iov, iovcnt, 0, 0};
+  struct iovec vec[BLOCK_SIZE];
+  int ret = 0;
+
+  if(fp == NULL || fp->mode == 'r' || iovcnt < 0)
+    return(-1);
+  OUFS_OPEN_INODE *node = fp->node;
+
+  if(fp->mode == 'a')
+    fp->offset = node->inode.size;
+  else if(fp->offset > node->inode.size && oufs_zero_tail(fp) != 0)
+    return(-1);
+
+  size_t total = oufs_iov_length(iov, iovcnt);
+  if(fp->offset >= BLOCKS_PER_INODE * BLOCK_SIZE)
+    return(0);
+  total = MIN(total, (size_t) (BLOCKS_PER_INODE * BLOCK_SIZE - fp->offset));
+  if(total == 0)
+    return(0);
+
+  int first = fp->offset / BLOCK_SIZE;
+  int last = (fp->offset + total - 1) / BLOCK_SIZE;
+
+  OUFS_IO_RUN *run = malloc(sizeof(OUFS_IO_RUN));
+  if(run == NULL)
+    return(-1);
+  run->n_blocks = 0;
+  run->nvec = 0;
+
+  for(int index = first; index <= last && ret == 0; ++index) {
+    int lo = (index == first) ? fp->offset % BLOCK_SIZE : 0;
+    int hi = (index == last) ? (fp->offset + total - 1) % BLOCK_SIZE + 1 : BLOCK_SIZE;
+    BLOCK_REFERENCE ref = node->inode.data[index];
+
+    if(hi - lo == BLOCK_SIZE && ref != UNALLOCATED_BLOCK && !(node->shared & (1 << index)) &&
+       !(node->cached & (1 << index))) {
+      // Overwrite in place
+      int nvec = oufs_iov_take(&c, BLOCK_SIZE, vec, BLOCK_SIZE);
+      if(nvec < 0)
+	ret = -1;
+      else
+	ret = oufs_io_run_add(run, ref, vec, nvec, 1);
+    }else{
+      BLOCK *b = oufs_cache_block(fp, index);
+      if(b == NULL) {
+	ret = -1;
+	break;
+      }
+      oufs_iov_copy(&c, &b->data.data[lo], hi - lo, 0);
+      node->dirty |= 1 << index;
+    }
+  }
+  if(ret == 0)
+    ret = oufs_io_run_flush(run, 1);
+  free(run);
+  if(ret != 0)
+    return(-1);
+
+  fp->offset += total;
+  if(fp->offset > node->inode.size) {
+    node->inode.size = fp->offset;
+    node->inode_dirty = 1;
+  }
+  return(total);
+}
+
+// Entry points: each holds the open file's lock around the implementation
+// above.  Reads share the lock; anything that changes the file holds it
+// alone, so an append claims the end of the file and writes it atomically.
+
+/**
+ * Write to a file (see oufs_fwrite_locked())
+ */
+int oufs_fwrite(OUFILE *fp, unsigned char * buf, int len)
+{
+  if(fp == NULL)
+    return(-1);
+  oufs_lock_write(fp);
+  int ret = oufs_fwrite_locked(fp, buf, len);
+  if(ret > 0)
+    fp->node->generation++;
+  oufs_unlock(fp);
+  return(ret);
+}
+
+/**
+ * Write several buffers to a file (see oufs_fwritev_locked())
+ */
+int oufs_fwritev(OUFILE *fp, const struct iovec *iov, int iovcnt)
+{
+  if(fp == NULL)
+    return(-1);
+  oufs_lock_write(fp);
+  int ret = oufs_fwritev_locked(fp, iov, iovcnt);
+  if(ret > 0)
+    fp->node->generation++;
+  oufs_unlock(fp);
+  return(ret);
+}
+
+/**
+ * Read from a file (see oufs_fread_locked())
+ */
+int oufs_fread(OUFILE *fp, unsigned char * buf, int len)
+{
+  if(fp == NULL)
+    return(-1);
+  if(oufs_lock_read(fp) != 0)
+    return(-1);
+  int ret = oufs_fread_locked(fp, buf, len);
+  oufs_unlock(fp);
+  return(ret);
+}
+
+/**
+ * Read from a file into several buffers (see oufs_freadv_locked())
+ */
+int oufs_freadv(OUFILE *fp, const struct iovec *iov, int iovcnt)
+{
+  if(fp == NULL)
+    return(-1);
+  if(oufs_lock_read(fp) != 0)
+    return(-1);
+  int ret = oufs_freadv_locked(fp, iov, iovcnt);
+  oufs_unlock(fp);
+  return(ret);
+}
+
+/**
+ * Zero-copy read (see oufs_fread_zerocopy_locked()).  A concurrent writer
+ * to the same block may change the data while the caller looks at it.
+ */
+int oufs_fread_zerocopy(OUFILE *fp, const unsigned char **data, int len)
+{
+  if(fp == NULL)
+    return(-1);
+  if(oufs_lock_read(fp) != 0)
+    return(-1);
+  int ret = oufs_fread_zerocopy_locked(fp, data, len);
+  oufs_unlock(fp);
+  return(ret);
+}
+
+/**
+ * Reserve blocks for a range of a file (see oufs_fallocate_locked())
+ */
+int oufs_fallocate(OUFILE *fp, int offset, int len)
+{
+  if(fp == NULL)
+    return(-1);
+  oufs_lock_write(fp);
+  int ret = oufs_fallocate_locked(fp, offset, len);
+  oufs_unlock(fp);
+  return(ret);
+}
+
+/**
+ * Set the size of a file (see oufs_ftruncate_locked())
+ */
+int oufs_ftruncate(OUFILE *fp, int length)
+{
+  if(fp == NULL)
+    return(-1);
+  oufs_lock_write(fp);
+  int ret = oufs_ftruncate_locked(fp, length);
+  if(ret == 0)
+    fp->node->generation++;
+  oufs_unlock(fp);
+  return(ret);
+}
+
+/**
+ * Create a file (truncating it if it exists) and fill it with the contents
+ * of standard input
+ *
+ * @param cwd Absolute path representing the current working directory
+ * @param path Absolute or relative path to the file
+ * @return 0 on success; -1 on error
+ */
+int oufs_zcreate(char *cwd, char* path)
+{
+  // Room for a whole file: one large write
+  unsigned char buf[BLOCKS_PER_INODE * BLOCK_SIZE];
+  size_t n;
+  int ret = 0;
+
+  OUFILE *fp = oufs_fopen(cwd, path, "w");
+  if(fp == NULL)
+    return(-1);
+  while((n = fread(buf, 1, sizeof(buf), stdin)) > 0) {
+    if(oufs_fwrite(fp, buf, n) != n) {
+      fprintf(stderr, "%s: file is full\n", path);
+      ret = -1;
+      break;
+    }
+  }
+  if(oufs_fclose(fp) != 0)
+    ret = -1;
+  return(ret);
+}
+
+/**
+ * qsort() comparator: order directory entries by name
+ */
+static int oufs_dirent_cmp(const void *a, const void *b)
+{
+  const OUDIRENT *ea = (const OUDIRENT *) a;
+  const OUDIRENT *eb = (const OUDIRENT *) b;
+  return(strncmp(ea->name, eb->name, FILE_NAME_SIZE));
+}
+
+/**
+ * Merge the sorted runs of a directory stream's entries into one sorted list
+ *
+ * @param dir Directory stream whose entries consist of sorted runs
+ * @param run_start Index of the first entry of each run, followed by n_entries
+ * @param n_runs Number of runs
+ * @return 0 on success; -1 if out of memory (entries are left unchanged)
+ */
+static int oufs_dir_merge_runs(OUDIR *dir, int *run_start, int n_runs)
+{
+  int head[2 * BLOCKS_PER_INODE];
+  OUDIRENT *merged = malloc((dir->n_entries > 0 ? dir->n_entries : 1) * sizeof(OUDIRENT));
+  if(merged == NULL)
+    return(-1);
+
+  for(int r = 0; r < n_runs; ++r)
+    head[r] = run_start[r];
+
+  // There are only a handful of runs: pick the smallest head each time
+  for(int n = 0; n < dir->n_entries; ++n) {
+    int best = -1;
+    for(int r = 0; r < n_runs; ++r) {
+      if(head[r] == run_start[r + 1])
+	continue;
+      if(best < 0 || oufs_dirent_cmp(&dir->entries[head[r]], &dir->entries[head[best]]) < 0)
+	best = r;
+    }
+    merged[n] = dir->entries[head[best]++];
+  }
+
+  free(dir->entries);
+  dir->entries = merged;
+  return(0);
+}
+
+/**
+ * Open a directory for reading.  All allocated entries of all of the
+ * directory's blocks are gathered and ordered by name, so oufs_readdir()
+ * hands them out in order.  When every block is in sorted form the blocks
+ * are merged; otherwise the entries are sorted.
+ *
+ * @param cwd Absolute path representing the current working directory
+ * @param path Absolute or relative path to the directory
+ * @return A directory stream, or NULL if path is not an existing directory
+ */
+OUDIR* oufs_opendir(char *cwd, char *path)
+{
+  INODE_REFERENCE parent;
+  INODE_REFERENCE child;
+  INODE inode;
+
+  if(oufs_find_file(cwd, path, &parent, &child, NULL) < 0 || child >= N_INODES)
+    return(NULL);
+  if(oufs_read_inode_by_reference(child, &inode) != 0 || inode.type != IT_DIRECTORY)
+    return(NULL);
+
+  OUDIR *dir = malloc(sizeof(OUDIR));
+  if(dir == NULL)
+    return(NULL);
+  dir->inode_reference = child;
+  dir->n_entries = 0;
+  dir->next = 0;
+  dir->attributes_loaded = 0;
+  // inode.size counts the entries, so this is normally exact
+  int capacity = inode.size > 0 ? inode.size : DIRECTORY_ENTRIES_PER_BLOCK;
+  dir->entries = malloc(capacity * sizeof(OUDIRENT));
+  if(dir->entries == NULL) {
+    free(dir);
+    return(NULL);
+  }
+
+  // Each sorted block contributes one or two sorted runs (. and .. form
+  //  their own run)
+  int run_start[2 * BLOCKS_PER_INODE + 1];
+  int n_runs = 0;
+  int sorted = 1;
+
+  for(int b = 0; b < BLOCKS_PER_INODE; ++b) {
+    if(inode.data[b] == UNALLOCATED_BLOCK)
+      continue;
+    const BLOCK *block = vdisk_pin_block(inode.data[b]);
+    if(block == NULL)
+      continue;
+    int first = (b == 0) ? 2 : 0;
+    if(!oufs_directory_block_is_sorted(block, first))
+      sorted = 0;
+    for(int i = 0; i < DIRECTORY_ENTRIES_PER_BLOCK; ++i) {
+      const DIRECTORY_ENTRY *entry = &block->directory.entry[i];
+      if(i == 0 || i == first)
+	run_start[n_runs++] = dir->n_entries;
+      if(entry->inode_reference == UNALLOCATED_INODE)
+	continue;
+      if(dir->n_entries == capacity) {
+	// Size was stale: grow
+	OUDIRENT *grown = realloc(dir->entries, 2 * capacity * sizeof(OUDIRENT));
+	if(grown == NULL) {
+	  vdisk_unpin_block(inode.data[b]);
+	  oufs_closedir(dir);
+	  return(NULL);
+	}
+	dir->entries = grown;
+	capacity *= 2;
+      }
+      OUDIRENT *ent = &dir->entries[dir->n_entries++];
+      strncpy(ent->name, entry->name, FILE_NAME_SIZE);
+      ent->name[FILE_NAME_SIZE - 1] = 0;
+      ent->inode_reference = entry->inode_reference;
+      // Filled in by oufs_readdir()
+      ent->type = IT_NONE;
+    }
+    vdisk_unpin_block(inode.data[b]);
+  }
 
-            size++;
-        }
+  run_start[n_runs] = dir->n_entries;
 
-    }
-    
-    //qsort(newArray, size of array...)
+  if(!sorted || oufs_dir_merge_runs(dir, run_start, n_runs) != 0)
+    qsort(dir->entries, dir->n_entries, sizeof(OUDIRENT), oufs_dirent_cmp);
+  return(dir);
+}
+
+/**
+ * Fetch the next entry (in name order) from a directory stream
+ *
+ * @param dir Directory stream from oufs_opendir()
+ * @return The next entry, with its type filled in; NULL at the end of the
+ *         directory.  The entry is valid until oufs_closedir().
+ */
+OUDIRENT* oufs_readdir(OUDIR *dir)
+{
+  if(dir == NULL || dir->next >= dir->n_entries)
+    return(NULL);
 
-    qsort(newArray, size, sizeof(char*), cstring_cmp);
+  OUDIRENT *ent = &dir->entries[dir->next++];
+  if(!dir->attributes_loaded && ent->type == IT_NONE) {
+    INODE inode;
+    if(oufs_read_inode_by_reference(ent->inode_reference, &inode) == 0)
+      ent->type = inode.type;
+  }
+  return(ent);
+}
 
-    // counter to parse through the directory entries per block
-    int ctr = 0;
-    // while the counter is not the size 
-    while(ctr != size)
-    {
-	// as we parse through the directory entries per block
-        for(int i = 0; i < DIRECTORY_ENTRIES_PER_BLOCK; i++)
-	{
+/**
+ * qsort() comparator: order entry pointers by the inode block holding the
+ * entry's inode
+ */
+static int oufs_dirent_inode_block_cmp(const void *a, const void *b)
+{
+  const OUDIRENT *ea = *(const OUDIRENT **) a;
+  const OUDIRENT *eb = *(const OUDIRENT **) b;
+  int ba = ea->inode_reference / INODES_PER_BLOCK;
+  int bb = eb->inode_reference / INODES_PER_BLOCK;
+  return(ba - bb);
+}
+
+/**
+ * Fill in the attributes of every entry of a directory stream.  The entries
+ * are visited in inode block order so that each inode block is read once,
+ * no matter how many of the directory's children it holds.
+ *
+ * @param dir Directory stream from oufs_opendir()
+ * @return 0 on success; -1 on error
+ */
+static int oufs_dir_load_attributes(OUDIR *dir)
+{
+  if(dir->n_entries == 0) {
+    dir->attributes_loaded = 1;
+    return(0);
+  }
 
-	    // if the newArray is the same as the entry name, then print
-	    if(strcmp(block.directory.entry[i].name, newArray[ctr]) == 0)
-	    {
-		// load the inode reference 
-		oufs_read_inode_by_reference(block.directory.entry[i].inode_reference, &ichild);
-		// if the inode the type is file
-		if(ichild.type == 'F')
-		{
-		    // print without the '/'
-		    printf("%s\n", newArray[ctr]);
+  OUDIRENT **order = malloc(dir->n_entries * sizeof(OUDIRENT *));
+  if(order == NULL)
+    return(-1);
+  for(int i = 0; i < dir->n_entries; ++i)
+    order[i] = &dir->entries[i];
+  qsort(order, dir->n_entries, sizeof(OUDIRENT *), oufs_dirent_inode_block_cmp);
+
+  const BLOCK *block = NULL;
+  BLOCK_REFERENCE loaded = UNALLOCATED_BLOCK;
+  for(int i = 0; i < dir->n_entries; ++i) {
+    OUDIRENT *ent = order[i];
+    BLOCK_REFERENCE needed = ent->inode_reference / INODES_PER_BLOCK + 1;
+    if(needed != loaded) {
+      if(block != NULL)
+	vdisk_unpin_block(loaded);
+      if((block = vdisk_pin_block(needed)) == NULL) {
+	free(order);
+	return(-1);
+      }
+      loaded = needed;
+    }
+    const INODE *inode = &block->inodes.inode[ent->inode_reference % INODES_PER_BLOCK];
+    ent->type = inode->type;
+    ent->n_references = inode->n_references;
+    ent->size = inode->size;
+  }
+  if(block != NULL)
+    vdisk_unpin_block(loaded);
+  free(order);
 
-		}
-		else // else ichild is a directory, so append a '/', then print
-		{
-		    strcat(newArray[ctr], "/");
-		    printf("%s\n", newArray[ctr]);
+  dir->attributes_loaded = 1;
+  return(0);
+}
 
-		}
+/**
+ * Fetch the next entry (in name order) from a directory stream, together
+ * with its type, size and link count.  The first call batches the inode
+ * reads for the whole directory.
+ *
+ * @param dir Directory stream from oufs_opendir()
+ * @return The next entry; NULL at the end of the directory or on error
+ */
+OUDIRENT* oufs_readdirplus(OUDIR *dir)
+{
+  if(dir == NULL)
+    return(NULL);
+  if(!dir->attributes_loaded && oufs_dir_load_attributes(dir) != 0)
+    return(NULL);
+  return(oufs_readdir(dir));
+}
 
-	    }
+/**
+ * Release a directory stream
+ *
+ * @param dir Directory stream from oufs_opendir()
+ */
+void oufs_closedir(OUDIR *dir)
+{
+  if(dir == NULL)
+    return;
+  free(dir->entries);
+  free(dir);
+}
 
+/*
+ * List a directory (one name per line, directories followed by a /), or
+ * give the name of a file
+ *
+ * @param cwd Absolute path representing the current working directory
+ * @param path Absolute or relative path to the file/directory
+ * @return 0 if success
+ *         -1 if path does not exist
+ */
+int oufs_list(char *cwd, char *path)
+{
+    INODE_REFERENCE parent;
+    INODE_REFERENCE child;
+    char local_name[MAX_PATH_LENGTH];
+    INODE inode;
 
-	}
+    // find the file
+    if(oufs_find_file(cwd, path, &parent, &child, local_name) < 0 || child >= N_INODES)
+    {
+	fprintf(stderr, "%s: not found\n", path);
+	return -1;
+    }
+    oufs_read_inode_by_reference(child, &inode);
 
-        ++ctr;
+    // a file: just give its name
+    if(inode.type == IT_FILE)
+    {
+	printf("%s\n", local_name);
+	return 0;
+    }
 
+    // a directory: stream its entries in sorted order
+    OUDIR *dir = oufs_opendir(cwd, path);
+    if(dir == NULL)
+    {
+	fprintf(stderr, "%s: cannot open directory\n", path);
+	return -1;
+    }
+    OUDIRENT *ent;
+    while((ent = oufs_readdir(dir)) != NULL)
+    {
+	if(ent->type == IT_DIRECTORY)
+	    printf("%s/\n", ent->name);
+	else
+	    printf("%s\n", ent->name);
     }
+    oufs_closedir(dir);
 
     return 0;
 }
 
+/**
+ * Print one line of a long listing
+ */
+static void oufs_print_long(char type, unsigned char n_references, unsigned int size, char *name)
+{
+  printf("%c %3d %6u %s%s\n", type, n_references, size, name,
+	 type == IT_DIRECTORY ? "/" : "");
+}
+
+/*
+ * Long listing: like oufs_list(), but each name is preceded by its type,
+ * link count and size (bytes for a file, entries for a directory)
+ *
+ * @param cwd Absolute path representing the current working directory
+ * @param path Absolute or relative path to the file/directory
+ * @return 0 if success
+ *         -1 if path does not exist
+ */
+int oufs_list_long(char *cwd, char *path)
+{
+  INODE_REFERENCE parent;
+  INODE_REFERENCE child;
+  char local_name[MAX_PATH_LENGTH];
+  INODE inode;
+
+  if(oufs_find_file(cwd, path, &parent, &child, local_name) < 0 || child >= N_INODES) {
+    fprintf(stderr, "%s: not found\n", path);
+    return(-1);
+  }
+  oufs_read_inode_by_reference(child, &inode);
+
+  if(inode.type == IT_FILE) {
+    oufs_print_long(inode.type, inode.n_references, inode.size, local_name);
+    return(0);
+  }
+
+  OUDIR *dir = oufs_opendir(cwd, path);
+  if(dir == NULL) {
+    fprintf(stderr, "%s: cannot open directory\n", path);
+    return(-1);
+  }
+  OUDIRENT *ent;
+  while((ent = oufs_readdirplus(dir)) != NULL)
+    oufs_print_long(ent->type, ent->n_references, ent->size, ent->name);
+  oufs_closedir(dir);
+
+  return(0);
+}
+
 /**
   * This function will remove a specified directory.
   *
@@ -880,7 +3297,6 @@ int oufs_rmdir(char *cwd, char *path)
     INODE_REFERENCE parentRef;
     INODE_REFERENCE childRef;
 
-    // BLOCK block;
     // INODE objects for the parent and child
     INODE parent;
     INODE child;
@@ -888,124 +3304,582 @@ int oufs_rmdir(char *cwd, char *path)
     char local_name[MAX_PATH_LENGTH];
     // ret is used to hold the return value of when find_file is called
     int ret;
-    //int inode_child_size;
-  //  int flag = 0;
 
-
-    // if find_file throws an error, then stderr
-    if((ret = oufs_find_file(cwd, path, &parentRef, &childRef, local_name)) < -1)
+    // if find_file throws an error or the child does not exist, stderr and exit function
+    if((ret = oufs_find_file(cwd, path, &parentRef, &childRef, local_name)) < 0 ||
+       childRef == UNALLOCATED_INODE)
     {
 	if(debug)
 	    fprintf(stderr, "oufs_rmdir(): ret = %d\n", ret);
-//	return -1;
+	fprintf(stderr, "%s: not found\n", path);
+	return -1;
     }
-  
-    // if the child reference is unallocated, stderr and exit function
-    if(childRef == UNALLOCATED_BLOCK)
+
+    // the root, . and .. can never be removed
+    if(childRef == 0 || strcmp(local_name, ".") == 0 || strcmp(local_name, "..") == 0)
     {
-	fprintf(stderr, "Child is unallocated\n");
+	fprintf(stderr, "Cannot remove %s\n", path);
 	return -1;
-
     }
 
     // read the inode by reference for the parent and child references
     oufs_read_inode_by_reference(parentRef, &parent);
     oufs_read_inode_by_reference(childRef, &child);
 
-    //inode_child_size = child.size;
-    //if(child.size == 2)
-	//inode_child_size++;
-
-    //printf("inode_child_size is %d\n", inode_child_size);
-    //printf("child.size is %d\n", child.size);
-    //printf("childRef is %d\n", childRef);
-   
-    //printf("inode parent is %d\n", parent);
+    if(child.type != IT_DIRECTORY)
+    {
+	fprintf(stderr, "%s is not a directory\n", path);
+	return -1;
+    }
 
     // if the child size is not 2, exit the program 
     if(child.size > 2)
     {
 	fprintf(stderr, "Cannot remove a parent directory!\n");
 	return -1;
+    }
 
+    // take the name out of the parent; this compacts the parent's directory
+    // block (no hole is left behind) and updates the parent size
+    oufs_directory_remove_entry(parentRef, &parent, local_name, strlen(local_name));
+
+    // release the child's inode and directory blocks with a single update
+    // of the master block
+    BLOCK block;
+    pthread_mutex_lock(&oufs_master_lock);
+    vdisk_read_block(MASTER_BLOCK_REFERENCE, &block);
+    block.master.inode_allocated_flag[childRef >> 3] &= ~(1 << (childRef & 7));
+    for(int i = 0; i < BLOCKS_PER_INODE; i++)
+    {
+	if(child.data[i] != UNALLOCATED_BLOCK)
+	    block.master.block_allocated_flag[child.data[i] >> 3] &= ~(1 << (child.data[i] & 7));
     }
-    else // child.size is <= 2
+    vdisk_write_block(MASTER_BLOCK_REFERENCE, &block);
+    pthread_mutex_unlock(&oufs_master_lock);
+
+    // leave the inode in its freshly formatted state
+    child.type = IT_NONE;
+    child.n_references = 1;
+    for(int i = 0; i < BLOCKS_PER_INODE; i++)
     {
-	// block object used to access various data in the data structure
-	BLOCK block;
+	child.data[i] = UNALLOCATED_BLOCK;
+    }
+    child.size = 0;
+    oufs_write_inode_by_reference(childRef, &child);
+    oufs_bloom_invalidate(childRef);
 
-	// clean memory block
-	memset(&block, 0, 256);
-	// write the child.data master block
-	vdisk_write_block(child.data[0], &block);
+    return 0;
+}
 
-	// clean the inode memory block
-	memset(&block, 0, sizeof(INODE));
-    
-	// write the inode by reference for the child reference
-	oufs_write_inode_by_reference(childRef, &child);
-    
-	// decrement size b/c we've removed the parent directory
-	parent.size--;
-	// write the inode parent reference
-	oufs_write_inode_by_reference(parentRef, &parent);
-   
-	// read the parent data master block
-	vdisk_read_block(parent.data[0], &block);
-    
-	// loop through the directory blocks
-	for(int i = 0; i < DIRECTORY_ENTRIES_PER_BLOCK; i++)
-	{
-	    if(strcmp(local_name, block.directory.entry[i].name) == 0)
-	    {
-		// set the directory entry names as an empty string
-		strcpy(block.directory.entry[i].name, "");
-		// assign parentRef to the inode reference before setting it to unallocated
-		parentRef = block.directory.entry[i].inode_reference;
-		// then set it as unallocated, b/c we've removed the directory
-		block.directory.entry[i].inode_reference = UNALLOCATED_INODE;
-	  
-		// re-write the parent block, then break
-		vdisk_write_block(parent.data[0], &block);
-		break;
-	    }
+/**********************************************************************/
+// Links and clones
+//
+// A hard link is a second directory entry for the same inode
+// (n_references counts them).  A clone is a new inode whose data[] list
+// points at the same blocks as the original: nothing is copied until one of
+// the two files writes to a shared block, which then gets a block of its
+// own (see oufs_flush_buffer() and oufs_fwritev()).  Block sharing is found
+// by oufs_block_reference_counts(), so the disk format is unchanged.
 
-	}
-    
-	//printf("%d\n", childRef);
-    
-	// clean thee memory
-	memset(&block, 0, 256);
-	// read the master block
-	vdisk_read_block(0, &block);
-    
-	// FIXME: bug after rmdir, master block is not updating correctly
-	//printf("childRef before bit operation is %d\n", childRef);
-    
-	/*
-	   with inode_allocated_flag, I divide by 8 to find the correct byte in the table,
-	   then subtract it from the childRef % 8 so that I can locate the bit 
-	 *
-	 */
-	block.master.inode_allocated_flag[childRef / 8] &= ~(1 << (childRef % 8));//(childRef % 8) << 1;
-   
+/**
+ * Resolve the two sides of a link: an existing file and a new name
+ *
+ * @param cwd Absolute path representing the current working directory
+ * @param path_src Path to an existing file
+ * @param path_dst Path to a name that does not exist yet
+ * @param src Set to the inode of the file
+ * @param dst_parent Set to the directory that receives the new name
+ * @param dst_name Set to the new name
+ * @return 0 on success; -1 on error
+ */
+static int oufs_link_paths(char *cwd, char *path_src, char *path_dst, INODE_REFERENCE *src,
+			   INODE_REFERENCE *dst_parent, char *dst_name)
+{
+  INODE_REFERENCE parent;
+  INODE_REFERENCE child;
+  INODE inode;
+  char local_name[MAX_PATH_LENGTH];
+
+  if(oufs_find_file(cwd, path_src, &parent, src, local_name) < -1 ||
+     *src == UNALLOCATED_INODE) {
+    fprintf(stderr, "%s: not found\n", path_src);
+    return(-1);
+  }
+  oufs_read_inode_by_reference(*src, &inode);
+  if(inode.type != IT_FILE) {
+    fprintf(stderr, "%s: not a file\n", path_src);
+    return(-1);
+  }
 
-	//printf("childRef after bit operation is %d\n", childRef);
+  if(oufs_find_file(cwd, path_dst, dst_parent, &child, dst_name) < -1 ||
+     *dst_parent == UNALLOCATED_INODE) {
+    fprintf(stderr, "%s: parent directory does not exist\n", path_dst);
+    return(-1);
+  }
+  if(child != UNALLOCATED_INODE) {
+    fprintf(stderr, "%s: already exists\n", path_dst);
+    return(-1);
+  }
+  return(0);
+}
 
-	BLOCK deallocated_block;
+/**
+ * Make a hard link: a new name for an existing file
+ *
+ * @param cwd Absolute path representing the current working directory
+ * @param path_src Path to an existing file
+ * @param path_dst New name (must not exist)
+ * @return 0 on success; -1 on error
+ */
+int oufs_link(char *cwd, char *path_src, char *path_dst)
+{
+  INODE_REFERENCE src;
+  INODE_REFERENCE dst_parent;
+  char dst_name[MAX_PATH_LENGTH];
+  INODE inode;
+  INODE parent;
 
-	// read the 
-	vdisk_read_block(parent.data[0], &deallocated_block);
-    
-	block.master.block_allocated_flag[child.data[0] / 8] &= ~(1 << (child.data[0] % 8));//(parent.data[0] % 8) << 1;
-	//printf("parent.data[0] is %d\n", 
+  int ret = 0;
 
+  if(oufs_link_paths(cwd, path_src, path_dst, &src, &dst_parent, dst_name) != 0)
+    return(-1);
 
-	// printf("1 << (parent.data[0] % 8) is %d\n", (1 << (parent.data[0] % 8)));
-   
-	vdisk_write_block(0, &block);
-	// TODO: do the same thing but with parentRef
+  // An open file's inode is the one in the open-inode table
+  OUFS_OPEN_INODE *node = oufs_open_inode_find(src);
+  if(node != NULL) {
+    pthread_rwlock_wrlock(&node->lock);
+    inode = node->inode;
+  }else{
+    oufs_read_inode_by_reference(src, &inode);
+  }
+
+  oufs_read_inode_by_reference(dst_parent, &parent);
+  if(inode.n_references == 255) {
+    fprintf(stderr, "%s: too many links\n", path_src);
+    ret = -1;
+  }else if(oufs_directory_insert_entry(dst_parent, &parent, dst_name, src) != 0) {
+    ret = -1;
+  }else{
+    inode.n_references++;
+    if(node != NULL)
+      node->inode.n_references = inode.n_references;
+    oufs_write_inode_by_reference(src, node != NULL ? &node->inode : &inode);
+  }
+
+  if(node != NULL) {
+    pthread_rwlock_unlock(&node->lock);
+    oufs_open_inode_put(node);
+  }
+  return(ret);
+}
+
+/**
+ * Clone a file: a new file that shares all data blocks with the original,
+ * copying each one only when either file first writes to it.  Only
+ * metadata is written, no matter how large the file is.
+ *
+ * @param cwd Absolute path representing the current working directory
+ * @param path_src Path to an existing file
+ * @param path_dst Name of the clone (must not exist)
+ * @return 0 on success; -1 on error
+ */
+int oufs_clone(char *cwd, char *path_src, char *path_dst)
+{
+  INODE_REFERENCE src;
+  INODE_REFERENCE dst_parent;
+  char dst_name[MAX_PATH_LENGTH];
+  INODE inode;
+
+  if(oufs_link_paths(cwd, path_src, path_dst, &src, &dst_parent, dst_name) != 0)
+    return(-1);
+
+  // An open source is held still, with its buffered changes on the disk
+  OUFS_OPEN_INODE *node = oufs_open_inode_find(src);
+  if(node != NULL) {
+    pthread_rwlock_wrlock(&node->lock);
+    oufs_flush_open_inode(node);
+  }
+
+  INODE_REFERENCE clone = oufs_create_file(dst_parent, dst_name);
+  if(clone != UNALLOCATED_INODE) {
+    // Same contents, one reference of its own
+    oufs_read_inode_by_reference(src, &inode);
+    inode.n_references = 1;
+    oufs_write_inode_by_reference(clone, &inode);
+  }
+
+  if(node != NULL) {
+    // From now on every block of the source is shared
+    if(clone != UNALLOCATED_INODE)
+      for(int i = 0; i < BLOCKS_PER_INODE; ++i)
+	if(inode.data[i] != UNALLOCATED_BLOCK)
+	  node->shared |= 1 << i;
+    pthread_rwlock_unlock(&node->lock);
+    oufs_open_inode_put(node);
+  }
+  return(clone == UNALLOCATED_INODE ? -1 : 0);
+}
+
+/**
+ * Account for a file having lost one of its names (the directory entry is
+ * already gone).  When it was the last name, the inode and every data block
+ * that no clone still uses are released, now or by the last oufs_fclose().
+ *
+ * @param i Inode reference of the file
+ * @param inode The file's inode as read from disk
+ */
+static void oufs_drop_name(INODE_REFERENCE i, INODE *inode)
+{
+  OUFS_OPEN_INODE *node = oufs_open_inode_find(i);
+  if(node != NULL) {
+    // Open: the open-inode table has the current inode
+    pthread_rwlock_wrlock(&node->lock);
+    if(node->inode.n_references > 1) {
+      node->inode.n_references--;
+      node->inode_dirty = 1;
+    }else{
+      // Last name: released by the last oufs_fclose()
+      node->unlinked = 1;
     }
-    return 0;
+    pthread_rwlock_unlock(&node->lock);
+    oufs_open_inode_put(node);
+  }else if(inode->n_references > 1) {
+    // Other names remain
+    inode->n_references--;
+    oufs_write_inode_by_reference(i, inode);
+  }else{
+    // Last name: release the inode along with the blocks it alone uses
+    oufs_release_file(i, inode);
+  }
+}
+
+/**
+ * Remove a name for a file.  When the last name goes, the inode and every
+ * data block that no clone still uses are released (one master block
+ * update).
+ *
+ * @param cwd Absolute path representing the current working directory
+ * @param path Path to the file
+ * @return 0 on success; -1 on error
+ */
+int oufs_remove(char *cwd, char *path)
+{
+  INODE_REFERENCE parent_ref;
+  INODE_REFERENCE child_ref;
+  char local_name[MAX_PATH_LENGTH];
+  INODE parent;
+  INODE child;
+
+  if(oufs_find_file(cwd, path, &parent_ref, &child_ref, local_name) < 0 ||
+     child_ref == UNALLOCATED_INODE) {
+    fprintf(stderr, "%s: not found\n", path);
+    return(-1);
+  }
+  oufs_read_inode_by_reference(child_ref, &child);
+  if(child.type != IT_FILE) {
+    fprintf(stderr, "%s: not a file\n", path);
+    return(-1);
+  }
+
+  oufs_read_inode_by_reference(parent_ref, &parent);
+  oufs_directory_remove_entry(parent_ref, &parent, local_name, strlen(local_name));
+  oufs_drop_name(child_ref, &child);
+  return(0);
+}
+
+/**********************************************************************/
+// Recursive removal
+//
+// A whole subtree is taken apart in a few large steps rather than one
+// removal (master block, inode, parent directory) per entry: the inode table
+// is read once, the directory blocks of each level of the tree with one
+// batched read, and every inode and block freed below the top goes in a
+// single master block update, with each inode block written once.
+
+/**
+ * An inode within a copy of the inode table
+ */
+static INODE *oufs_table_inode(BLOCK *table, INODE_REFERENCE i)
+{
+  return(&table[i / INODES_PER_BLOCK].inodes.inode[i % INODES_PER_BLOCK]);
+}
+
+/**
+ * Remove a directory along with everything below it (a file is simply
+ * removed).  The name is taken out of the parent first, so a crash part way
+ * through only leaves unreachable inodes and blocks behind, which zfsck -r
+ * releases.  A file that still has names outside the subtree only loses
+ * the names inside it; an open file is released by its last oufs_fclose();
+ * a block still used by a clone outside the subtree is kept.
+ *
+ * @param cwd Absolute path representing the current working directory
+ * @param path Path to the file or directory
+ * @return 0 on success; -1 on error
+ */
+int oufs_remove_recursive(char *cwd, char *path)
+{
+  INODE_REFERENCE parent_ref;
+  INODE_REFERENCE top;
+  char local_name[MAX_PATH_LENGTH];
+  INODE inode;
+
+  if(oufs_find_file(cwd, path, &parent_ref, &top, local_name) < 0 ||
+     top == UNALLOCATED_INODE) {
+    fprintf(stderr, "%s: not found\n", path);
+    return(-1);
+  }
+  if(top == 0 || strcmp(local_name, ".") == 0 || strcmp(local_name, "..") == 0) {
+    fprintf(stderr, "Cannot remove %s\n", path);
+    return(-1);
+  }
+  oufs_read_inode_by_reference(top, &inode);
+  if(inode.type != IT_DIRECTORY)
+    return(oufs_remove(cwd, path));
+
+  // The whole inode table, in one read
+  BLOCK_REFERENCE refs[N_BLOCKS_IN_DISK];
+  BLOCK table[N_INODE_BLOCKS];
+  for(int i = 0; i < N_INODE_BLOCKS; ++i)
+    refs[i] = i + 1;
+  if(vdisk_read_blocks(refs, N_INODE_BLOCKS, table) != 0)
+    return(-1);
+
+  // Collect the subtree one level at a time: the directories, and how many
+  // of each file's names are inside it
+  INODE_REFERENCE dirs[N_INODES];
+  unsigned char seen[N_INODES] = { 0 };
+  unsigned char names[N_INODES] = { 0 };
+  int n_dirs = 0;
+  dirs[n_dirs++] = top;
+  seen[top] = 1;
+  for(int level = 0; level < n_dirs; ) {
+    int end = n_dirs;
+    int n_refs = 0;
+    // Blocks of this level; never more than the disk holds, even on a
+    // damaged disk where directories share blocks
+    for(int d = level; d < end; ++d) {
+      INODE *dir = oufs_table_inode(table, dirs[d]);
+      for(int b = 0; b < BLOCKS_PER_INODE && n_refs < N_BLOCKS_IN_DISK; ++b)
+	if(dir->data[b] < N_BLOCKS_IN_DISK)
+	  refs[n_refs++] = dir->data[b];
+    }
+    BLOCK *blocks = malloc((n_refs + 1) * sizeof(BLOCK));
+    if(blocks == NULL || vdisk_read_blocks(refs, n_refs, blocks) != 0) {
+      free(blocks);
+      return(-1);
+    }
+    for(int k = 0; k < n_refs; ++k) {
+      for(int e = 0; e < DIRECTORY_ENTRIES_PER_BLOCK; ++e) {
+	DIRECTORY_ENTRY *entry = &blocks[k].directory.entry[e];
+	if(entry->inode_reference >= N_INODES || strcmp(entry->name, ".") == 0 ||
+	   strcmp(entry->name, "..") == 0)
+	  continue;
+	INODE_REFERENCE ref = entry->inode_reference;
+	if(oufs_table_inode(table, ref)->type == IT_DIRECTORY) {
+	  if(!seen[ref]) {
+	    seen[ref] = 1;
+	    dirs[n_dirs++] = ref;
+	  }
+	}else if(oufs_table_inode(table, ref)->type == IT_FILE && names[ref] < 255) {
+	  names[ref]++;
+	}
+      }
+    }
+    free(blocks);
+    level = end;
+  }
+
+  // Unreachable from here on
+  INODE parent;
+  oufs_read_inode_by_reference(parent_ref, &parent);
+  oufs_directory_remove_entry(parent_ref, &parent, local_name, strlen(local_name));
+
+  // Decide what is freed.  counts[] holds every inode's use of each block,
+  // freed[] the uses by inodes that go away: a block whose uses all go
+  // away is freed.
+  unsigned char counts[N_BLOCKS_IN_DISK] = { 0 };
+  unsigned char freed[N_BLOCKS_IN_DISK] = { 0 };
+  unsigned char release[N_INODES] = { 0 };
+  INODE_REFERENCE out_refs[N_INODES];
+  INODE out[N_INODES];
+  int n_out = 0;
+
+  for(INODE_REFERENCE i = 0; i < N_INODES; ++i) {
+    INODE *t = oufs_table_inode(table, i);
+    if(t->type == IT_NONE)
+      continue;
+    for(int b = 0; b < BLOCKS_PER_INODE; ++b)
+      if(t->data[b] < N_BLOCKS_IN_DISK && counts[t->data[b]] < 255)
+	counts[t->data[b]]++;
+  }
+  for(int d = 0; d < n_dirs; ++d)
+    release[dirs[d]] = 1;
+  for(INODE_REFERENCE i = 0; i < N_INODES; ++i) {
+    if(names[i] == 0)
+      continue;
+    OUFS_OPEN_INODE *node = oufs_open_inode_find(i);
+    if(node != NULL) {
+      // Open: handled through the open-inode table, as in oufs_remove()
+      pthread_rwlock_wrlock(&node->lock);
+      if(node->inode.n_references > names[i]) {
+	node->inode.n_references -= names[i];
+	node->inode_dirty = 1;
+      }else{
+	node->unlinked = 1;
+      }
+      pthread_rwlock_unlock(&node->lock);
+      oufs_open_inode_put(node);
+    }else if(oufs_table_inode(table, i)->n_references > names[i]) {
+      // Other names remain outside the subtree
+      out_refs[n_out] = i;
+      out[n_out] = *oufs_table_inode(table, i);
+      out[n_out++].n_references -= names[i];
+    }else{
+      release[i] = 1;
+    }
+  }
+  for(INODE_REFERENCE i = 0; i < N_INODES; ++i) {
+    INODE *t = oufs_table_inode(table, i);
+    if(release[i])
+      for(int b = 0; b < BLOCKS_PER_INODE; ++b)
+	if(t->data[b] < N_BLOCKS_IN_DISK)
+	  freed[t->data[b]]++;
+  }
+
+  // One master block update for everything
+  BLOCK block;
+  pthread_mutex_lock(&oufs_master_lock);
+  vdisk_read_block(MASTER_BLOCK_REFERENCE, &block);
+  for(INODE_REFERENCE i = 0; i < N_INODES; ++i)
+    if(release[i])
+      block.master.inode_allocated_flag[i >> 3] &= ~(1 << (i & 7));
+  for(int b = 0; b < N_BLOCKS_IN_DISK; ++b)
+    if(freed[b] > 0 && freed[b] >= counts[b])
+      block.master.block_allocated_flag[b >> 3] &= ~(1 << (b & 7));
+  vdisk_write_block(MASTER_BLOCK_REFERENCE, &block);
+  pthread_mutex_unlock(&oufs_master_lock);
+
+  // Released inodes go back to their freshly formatted state; each inode
+  // block is written once
+  for(INODE_REFERENCE i = 0; i < N_INODES; ++i) {
+    if(!release[i])
+      continue;
+    out_refs[n_out] = i;
+    out[n_out].type = IT_NONE;
+    out[n_out].n_references = 1;
+    for(int b = 0; b < BLOCKS_PER_INODE; ++b)
+      out[n_out].data[b] = UNALLOCATED_BLOCK;
+    out[n_out++].size = 0;
+  }
+  int ret = oufs_write_inodes(n_out, out_refs, out);
+  for(int d = 0; d < n_dirs; ++d)
+    oufs_bloom_invalidate(dirs[d]);
+  return(ret);
 }
 
+/**********************************************************************/
+// Renaming
+//
+// A move only rewrites directory entries: the new name is added (or an
+// existing file's entry is pointed at the moved inode) before the old name
+// is taken out, so a crash leaves the file under one of its names or both,
+// never neither.  A directory that changes parent also gets its .. entry
+// rewritten.  Inodes and data blocks stay where they are.
+
+/**
+ * Move a file or directory to a new name.  If the destination is an
+ * existing directory, the source moves into it under its own name; if it is
+ * an existing file and the source is a file too, that file loses this name
+ * (as with oufs_remove()).  A directory cannot be moved into its own
+ * subtree.
+ *
+ * @param cwd Absolute path representing the current working directory
+ * @param path_src Path to an existing file or directory
+ * @param path_dst Path to the new name
+ * @return 0 on success; -1 on error
+ */
+int oufs_rename(char *cwd, char *path_src, char *path_dst)
+{
+  INODE_REFERENCE src_parent;
+  INODE_REFERENCE src;
+  INODE_REFERENCE dst_parent;
+  INODE_REFERENCE dst;
+  char src_name[MAX_PATH_LENGTH];
+  char dst_name[MAX_PATH_LENGTH];
+  INODE inode;
+  INODE other;
+
+  if(oufs_find_file(cwd, path_src, &src_parent, &src, src_name) < 0 ||
+     src == UNALLOCATED_INODE) {
+    fprintf(stderr, "%s: not found\n", path_src);
+    return(-1);
+  }
+  if(src == 0 || strcmp(src_name, ".") == 0 || strcmp(src_name, "..") == 0) {
+    fprintf(stderr, "Cannot move %s\n", path_src);
+    return(-1);
+  }
+  oufs_read_inode_by_reference(src, &inode);
+
+  if(oufs_find_file(cwd, path_dst, &dst_parent, &dst, dst_name) < -1 ||
+     dst_parent == UNALLOCATED_INODE) {
+    fprintf(stderr, "%s: parent directory does not exist\n", path_dst);
+    return(-1);
+  }
+  if(dst != UNALLOCATED_INODE) {
+    oufs_read_inode_by_reference(dst, &other);
+    if(other.type == IT_DIRECTORY) {
+      // Into the directory, under the same name
+      dst_parent = dst;
+      strcpy(dst_name, src_name);
+      dst = oufs_lookup_directory_element(dst_parent, &other, dst_name);
+      if(dst != UNALLOCATED_INODE)
+	oufs_read_inode_by_reference(dst, &other);
+    }
+  }
+  if(dst == src)
+    // Already there
+    return(0);
+  if(dst != UNALLOCATED_INODE && (other.type != IT_FILE || inode.type != IT_FILE)) {
+    fprintf(stderr, "%s: already exists\n", path_dst);
+    return(-1);
+  }
+
+  if(inode.type == IT_DIRECTORY) {
+    // The new parent must not be inside the directory being moved
+    INODE_REFERENCE up = dst_parent;
+    for(int depth = 0; up != 0 && up < N_INODES && depth < N_INODES; ++depth) {
+      INODE dir;
+      if(up == src) {
+	fprintf(stderr, "Cannot move %s into itself\n", path_src);
+	return(-1);
+      }
+      oufs_read_inode_by_reference(up, &dir);
+      up = oufs_find_directory_element_n(&dir, "..", 2);
+    }
+  }
+
+  // 1. The new name
+  INODE src_dir;
+  INODE dst_dir;
+  INODE *new_parent = (dst_parent == src_parent) ? &src_dir : &dst_dir;
+  oufs_read_inode_by_reference(src_parent, &src_dir);
+  if(dst_parent != src_parent)
+    oufs_read_inode_by_reference(dst_parent, &dst_dir);
+  if(dst != UNALLOCATED_INODE) {
+    oufs_directory_replace_entry(new_parent, dst_name, strlen(dst_name), src);
+  }else if(oufs_directory_insert_entry(dst_parent, new_parent, dst_name, src) != 0) {
+    return(-1);
+  }
+
+  // 2. A directory's .. follows it
+  if(inode.type == IT_DIRECTORY && dst_parent != src_parent)
+    oufs_directory_replace_entry(&inode, "..", 2, dst_parent);
+
+  // 3. The old name
+  oufs_directory_remove_entry(src_parent, &src_dir, src_name, strlen(src_name));
+
+  // A file that was overwritten has one name less
+  if(dst != UNALLOCATED_INODE)
+    oufs_drop_name(dst, &other);
+  return(0);
+}
@@ -0,0 +1,361 @@
+/**
+Serve the OU File System on a virtual disk to the z* tools.
+
+Usage: oufsd
+
+The disk (ZDISK) is opened once and kept open, so its caches stay warm
+between commands.  Requests arrive on a Unix domain socket (ZSOCKET, or the
+disk's name followed by .sock); while oufsd is running, zmkdir, zrmdir,
+ztouch, zfilez, zmore, zcreate, zappend and zremove hand their work to it
+instead of opening the disk themselves.  Only one oufsd serves a socket: a
+second one refuses to start (a socket left behind by an oufsd that died is
+replaced).  Stop it with SIGINT or SIGTERM.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "oufs_client.h"
+
+// Set by SIGINT/SIGTERM
+static volatile sig_atomic_t stopping = 0;
+
+// Output of the request being served goes to these files
+static FILE *out_file;
+static FILE *err_file;
+static int saved_stdout;
+static int saved_stderr;
+
+// Disk modification time after the last request: if something else changes
+// the disk in between, the cached directory filters are dropped
+static struct timespec last_mtime;
+
+static void stop(int sig)
+{
+  stopping = 1;
+}
+
+/**
+ * Drop the directory filters if the disk has changed behind our back
+ */
+static void check_disk(char *disk_name)
+{
+  struct stat st;
+  if(stat(disk_name, &st) == 0 &&
+     (st.st_mtim.tv_sec != last_mtime.tv_sec || st.st_mtim.tv_nsec != last_mtime.tv_nsec))
+    oufs_bloom_reset();
+}
+
+/**
+ * Remember the disk's modification time once a request is done
+ */
+static void note_disk(char *disk_name)
+{
+  struct stat st;
+  if(stat(disk_name, &st) == 0)
+    last_mtime = st.st_mtim;
+}
+
+/**
+ * Send stdout and stderr to the capture files
+ */
+static void capture_begin()
+{
+  fflush(stdout);
+  fflush(stderr);
+  ftruncate(fileno(out_file), 0);
+  lseek(fileno(out_file), 0, SEEK_SET);
+  ftruncate(fileno(err_file), 0);
+  lseek(fileno(err_file), 0, SEEK_SET);
+  dup2(fileno(out_file), STDOUT_FILENO);
+  dup2(fileno(err_file), STDERR_FILENO);
+}
+
+/**
+ * Put stdout and stderr back
+ */
+static void capture_end()
+{
+  fflush(stdout);
+  fflush(stderr);
+  dup2(saved_stdout, STDOUT_FILENO);
+  dup2(saved_stderr, STDERR_FILENO);
+}
+
+/**
+ * Send the captured contents of a file to the client
+ *
+ * @return 0 on success; -1 on error
+ */
+static int send_captured(int client, FILE *file, uint32_t n)
+{
+  char buf[BLOCK_SIZE * 4];
+  off_t offset = 0;
+
+  while(n > 0)
+  {
+    ssize_t m = pread(fileno(file), buf, MIN(n, sizeof(buf)), offset);
+    if(m <= 0)
+      return(-1);
+    if(oufs_write_full(client, buf, m) != 0)
+      return(-1);
+    offset += m;
+    n -= m;
+  }
+  return(0);
+}
+
+/**
+ * Write data to a file
+ *
+ * @param mode "w" to replace the contents, "a" to append
+ * @return 0 on success; -1 on error
+ */
+static int write_file(char *cwd, char *path, char *mode, unsigned char *data, int len)
+{
+  OUFILE *fp = oufs_fopen(cwd, path, mode);
+  if(fp == NULL)
+    return(-1);
+
+  int ret = 0;
+  if(len > 0 && oufs_fwrite(fp, data, len) != len)
+  {
+    fprintf(stderr, "%s: file is full\n", path);
+    ret = -1;
+  }
+  if(oufs_fclose(fp) != 0)
+    ret = -1;
+  return(ret);
+}
+
+/**
+ * Copy a file to stdout
+ *
+ * @return 0 on success; -1 on error
+ */
+static int read_file(char *cwd, char *path)
+{
+  OUFILE *fp = oufs_fopen(cwd, path, "r");
+  if(fp == NULL)
+    return(-1);
+
+  const unsigned char *data;
+  int n;
+  while((n = oufs_fread_zerocopy(fp, &data, BLOCK_SIZE)) > 0)
+    fwrite(data, 1, n, stdout);
+  oufs_fclose(fp);
+  return(n < 0 ? -1 : 0);
+}
+
+/**
+ * Run one request
+ *
+ * @return The status the matching z* tool would exit with
+ */
+static int run_request(OUFS_REQUEST *request, char *cwd, char *path, char *path2,
+                       unsigned char *data)
+{
+  switch(request->op)
+  {
+  case OUFS_OP_MKDIR:
+    return(oufs_mkdir(cwd, path) < 0 ? -1 : 0);
+  case OUFS_OP_RMDIR:
+    return(oufs_rmdir(cwd, path) < 0 ? -1 : 0);
+  case OUFS_OP_TOUCH:
+    return(oufs_ztouch(cwd, path) < 0 ? -1 : 0);
+  case OUFS_OP_LIST:
+    if(path[0] == '\0')
+      path = cwd;
+    if(request->flags & OUFS_FLAG_LONG)
+      return(oufs_list_long(cwd, path) == 0 ? 0 : -1);
+    return(oufs_list(cwd, path) == 0 ? 0 : -1);
+  case OUFS_OP_READ:
+    return(read_file(cwd, path));
+  case OUFS_OP_CREATE:
+    return(write_file(cwd, path, "w", data, request->data_len));
+  case OUFS_OP_APPEND:
+    return(write_file(cwd, path, "a", data, request->data_len));
+  case OUFS_OP_REMOVE:
+    if(request->flags & OUFS_FLAG_RECURSIVE)
+      return(oufs_remove_recursive(cwd, path) < 0 ? -1 : 0);
+    return(oufs_remove(cwd, path));
+  case OUFS_OP_RENAME:
+    return(oufs_rename(cwd, path, path2));
+  }
+  fprintf(stderr, "oufsd: unknown operation %d\n", request->op);
+  return(-1);
+}
+
+/**
+ * Serve the one request on a connection
+ *
+ * @return 0 on success; -1 if the request could not be read or answered
+ */
+static int serve(int client, char *disk_name)
+{
+  OUFS_REQUEST request;
+  OUFS_RESPONSE response;
+  char cwd[MAX_PATH_LENGTH];
+  char path[MAX_PATH_LENGTH];
+  char path2[MAX_PATH_LENGTH];
+  static unsigned char data[OUFS_MAX_DATA];
+
+  // Closed without a request: another oufsd checking whether we run
+  char first;
+  if(recv(client, &first, 1, MSG_PEEK) == 0)
+    return(0);
+
+  if(oufs_read_full(client, &request, sizeof(request)) != 0 ||
+     request.magic != OUFS_MAGIC ||
+     request.cwd_len >= MAX_PATH_LENGTH ||
+     request.path_len >= MAX_PATH_LENGTH ||
+     request.path2_len >= MAX_PATH_LENGTH ||
+     request.data_len > OUFS_MAX_DATA ||
+     oufs_read_full(client, cwd, request.cwd_len) != 0 ||
+     oufs_read_full(client, path, request.path_len) != 0 ||
+     oufs_read_full(client, path2, request.path2_len) != 0 ||
+     oufs_read_full(client, data, request.data_len) != 0)
+    return(-1);
+  cwd[request.cwd_len] = '\0';
+  path[request.path_len] = '\0';
+  path2[request.path2_len] = '\0';
+
+  check_disk(disk_name);
+  capture_begin();
+  response.status = run_request(&request, cwd, path, path2, data);
+  capture_end();
+  note_disk(disk_name);
+
+  response.out_len = lseek(fileno(out_file), 0, SEEK_END);
+  response.err_len = lseek(fileno(err_file), 0, SEEK_END);
+  if(oufs_write_full(client, &response, sizeof(response)) != 0 ||
+     send_captured(client, out_file, response.out_len) != 0 ||
+     send_captured(client, err_file, response.err_len) != 0)
+    return(-1);
+  return(0);
+}
+
+/**
+ * Make way for our socket.  A socket that refuses connections was left
+ * behind by an oufsd that died and is removed; one that accepts them
+ * belongs to an oufsd that is still running.
+ *
+ * @return 0 if the socket name can be bound; -1 if another oufsd serves it
+ */
+static int claim_socket(struct sockaddr_un *addr)
+{
+  int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(probe < 0)
+    // bind() will tell
+    return(0);
+
+  int ret = 0;
+  if(connect(probe, (struct sockaddr *) addr, sizeof(*addr)) == 0)
+    ret = -1;
+  else if(errno == ECONNREFUSED)
+    unlink(addr->sun_path);
+  close(probe);
+  return(ret);
+}
+
+int main(int argc, char** argv)
+{
+  // Fetch the key environment vars
+  char cwd[MAX_PATH_LENGTH];
+  char disk_name[MAX_PATH_LENGTH];
+  char socket_name[MAX_PATH_LENGTH];
+  oufs_get_environment(cwd, disk_name);
+  oufs_socket_name(disk_name, socket_name);
+
+  if(argc != 1)
+  {
+    // Wrong number of parameters
+    fprintf(stderr, "Usage: oufsd\n");
+    return(-1);
+  }
+
+  struct sockaddr_un addr;
+  if(strlen(socket_name) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "%s: socket name too long\n", socket_name);
+    return(-1);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_name);
+  if(claim_socket(&addr) != 0)
+  {
+    fprintf(stderr, "%s: oufsd is already running\n", socket_name);
+    return(-1);
+  }
+
+  out_file = tmpfile();
+  err_file = tmpfile();
+  saved_stdout = dup(STDOUT_FILENO);
+  saved_stderr = dup(STDERR_FILENO);
+  if(out_file == NULL || err_file == NULL || saved_stdout < 0 || saved_stderr < 0)
+  {
+    perror("oufsd");
+    return(-1);
+  }
+
+  // Open the virtual disk for as long as we run
+  if(vdisk_disk_open(disk_name) != 0)
+    return(-1);
+  note_disk(disk_name);
+
+  int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(server < 0)
+  {
+    perror("socket");
+    vdisk_disk_close();
+    return(-1);
+  }
+  if(bind(server, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+     listen(server, 16) != 0)
+  {
+    perror(socket_name);
+    close(server);
+    vdisk_disk_close();
+    return(-1);
+  }
+
+  // No SA_RESTART: a signal interrupts accept()
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stop;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  // A client that goes away mid-answer must not take us with it
+  signal(SIGPIPE, SIG_IGN);
+
+  while(!stopping)
+  {
+    int client = accept(server, NULL, NULL);
+    if(client < 0)
+    {
+      if(errno != EINTR)
+        perror("accept");
+      continue;
+    }
+    if(serve(client, disk_name) != 0)
+      fprintf(stderr, "oufsd: bad request\n");
+    close(client);
+  }
+
+  // Clean up
+  close(server);
+  unlink(socket_name);
+  vdisk_disk_close();
+  return(0);
+}
@@ -1,3 +1,6 @@
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include "vdisk.h"
 /*
  * Virtual disk implementation.
@@ -14,6 +17,15 @@
 
 int vdisk_fd = 0;
 
+// Pinned blocks (see vdisk_pin_block()).  When the disk file is large
+//  enough it is mapped read-only and pins point into the mapping;
+//  otherwise a pinned block is a private copy that is kept up to date by
+//  vdisk_write_block().
+static unsigned char *vdisk_map = NULL;
+static unsigned char *vdisk_pin_copy[N_BLOCKS_IN_DISK];
+static int vdisk_pin_count[N_BLOCKS_IN_DISK];
+static pthread_mutex_t vdisk_pin_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /**
  * Open the virtual disk
  *
@@ -56,6 +68,21 @@ int vdisk_disk_close()
     exit(-1);
   };
 
+  // Drop the mapping and any pinned copies
+  pthread_mutex_lock(&vdisk_pin_lock);
+  if(vdisk_map != NULL) {
+    munmap(vdisk_map, (size_t) N_BLOCKS_IN_DISK * BLOCK_SIZE);
+    vdisk_map = NULL;
+  }
+  for(int i = 0; i < N_BLOCKS_IN_DISK; ++i) {
+    if(vdisk_pin_count[i] != 0 && debug)
+      fprintf(stderr, "vdisk_disk_close(): block %d still pinned\n", i);
+    free(vdisk_pin_copy[i]);
+    vdisk_pin_copy[i] = NULL;
+    vdisk_pin_count[i] = 0;
+  }
+  pthread_mutex_unlock(&vdisk_pin_lock);
+
   // Close the file
   close(vdisk_fd);
 
@@ -89,14 +116,9 @@ int vdisk_read_block(BLOCK_REFERENCE block_ref, void *block)
     return(-2);
   }
 
-  // Lsek to the correct point in the file
-  if(lseek(vdisk_fd, block_ref * BLOCK_SIZE, SEEK_SET) < 0) {
-    fprintf(stderr, "vdisk_read_block(): seek failed\n");
-    return(-3);
-  }
-
-  // Read the block
-  if(read(vdisk_fd, block, BLOCK_SIZE) != BLOCK_SIZE) {
+  // Read the block.  pread() does not move the shared file offset, so
+  //  several threads may read blocks at the same time
+  if(pread(vdisk_fd, block, BLOCK_SIZE, (off_t) block_ref * BLOCK_SIZE) != BLOCK_SIZE) {
     fprintf(stderr, "vdisk_read_block(): read failed\n");
     return(-4);
   }
@@ -129,18 +151,234 @@ int vdisk_write_block(BLOCK_REFERENCE block_ref, void *block)
     return(-2);
   }
 
-  // Move to the beginning of the block
-  if(lseek(vdisk_fd, block_ref * BLOCK_SIZE, SEEK_SET) < 0) {
-    fprintf(stderr, "vdisk_write_block(): seek failed\n");
-    return(-3);
+  // Write the block at its position (without moving the shared file offset)
+  if(pwrite(vdisk_fd, block, BLOCK_SIZE, (off_t) block_ref * BLOCK_SIZE) != BLOCK_SIZE) {
+    fprintf(stderr, "vdisk_write_block(): read failed\n");
+    return(-4);
   }
 
-  // Read the block
-  if(write(vdisk_fd, block, BLOCK_SIZE) != BLOCK_SIZE) {
-    fprintf(stderr, "vdisk_write_block(): read failed\n");
+  // Keep a pinned copy current (a mapping sees the write by itself)
+  pthread_mutex_lock(&vdisk_pin_lock);
+  if(vdisk_pin_copy[block_ref] != NULL)
+    memcpy(vdisk_pin_copy[block_ref], block, BLOCK_SIZE);
+  pthread_mutex_unlock(&vdisk_pin_lock);
+
+  // Success
+  return(0);
+}
+
+/**
+ *  Read several disk blocks into consecutive block-sized slots of a buffer.
+ *  Runs of consecutive block references are fetched with a single read.
+ *
+ * @param block_refs Indices of the blocks to be loaded
+ * @param n Number of blocks
+ * @param blocks Buffer of (at least) n * BLOCK_SIZE bytes
+ * @return 0 on success; <0 on error
+ *
+ */
+int vdisk_read_blocks(BLOCK_REFERENCE *block_refs, int n, void *blocks)
+{
+  // Make sure that the disk is initialized
+  if(vdisk_fd == 0) {
+    fprintf(stderr, "vdisk_read_blocks(): disk not initialized\n");
+    exit(-1);
+  };
+
+  int i = 0;
+  while(i < n) {
+    // Find the run of consecutive blocks starting at i
+    int j = i + 1;
+    while(j < n && block_refs[j] == block_refs[j-1] + 1)
+      ++j;
+
+    if(debug)
+      fprintf(stderr, "##Reading blocks %d..%d\n", block_refs[i], block_refs[j-1]);
+
+    if(block_refs[j-1] >= N_BLOCKS_IN_DISK) {
+      fprintf(stderr, "vdisk_read_blocks(): bad block_ref(%d)\n", block_refs[j-1]);
+      return(-2);
+    }
+
+    size_t len = (size_t) (j - i) * BLOCK_SIZE;
+    if(pread(vdisk_fd, (char *) blocks + (size_t) i * BLOCK_SIZE, len,
+	     (off_t) block_refs[i] * BLOCK_SIZE) != (ssize_t) len) {
+      fprintf(stderr, "vdisk_read_blocks(): read failed\n");
+      return(-4);
+    }
+    i = j;
+  }
+
+  // Success
+  return(0);
+}
+
+/**
+ *  Map the whole disk file if it is large enough.  vdisk_pin_lock must be held.
+ */
+static void vdisk_try_map()
+{
+  struct stat st;
+
+  if(vdisk_map != NULL)
+    return;
+  if(fstat(vdisk_fd, &st) != 0 || st.st_size < (off_t) N_BLOCKS_IN_DISK * BLOCK_SIZE)
+    return;
+
+  void *map = mmap(NULL, (size_t) N_BLOCKS_IN_DISK * BLOCK_SIZE, PROT_READ, MAP_SHARED,
+		   vdisk_fd, 0);
+  if(map != MAP_FAILED)
+    vdisk_map = map;
+}
+
+/**
+ *  Pin a disk block and get a pointer to its contents, without copying it
+ *  into a caller's buffer.  The contents must not be modified through the
+ *  pointer; they reflect later vdisk_write_block() calls.  Every pin must be
+ *  matched by a vdisk_unpin_block().
+ *
+ * @param block_ref Index of the block
+ * @return Pointer to the block's BLOCK_SIZE bytes; NULL on error
+ *
+ */
+const void *vdisk_pin_block(BLOCK_REFERENCE block_ref)
+{
+  const void *ret = NULL;
+
+  // Make sure that the disk is initialized
+  if(vdisk_fd == 0) {
+    fprintf(stderr, "vdisk_pin_block(): disk not initialized\n");
+    exit(-1);
+  };
+
+  if(block_ref >= N_BLOCKS_IN_DISK) {
+    fprintf(stderr, "vdisk_pin_block(): bad block_ref(%d)\n", block_ref);
+    return(NULL);
+  }
+
+  pthread_mutex_lock(&vdisk_pin_lock);
+  vdisk_try_map();
+  if(vdisk_map != NULL) {
+    ret = vdisk_map + (size_t) block_ref * BLOCK_SIZE;
+  }else{
+    // No mapping: share one private copy per block among its pins
+    if(vdisk_pin_copy[block_ref] == NULL) {
+      unsigned char *copy = malloc(BLOCK_SIZE);
+      if(copy != NULL && vdisk_read_block(block_ref, copy) == 0) {
+	vdisk_pin_copy[block_ref] = copy;
+      }else{
+	free(copy);
+      }
+    }
+    ret = vdisk_pin_copy[block_ref];
+  }
+  if(ret != NULL)
+    ++vdisk_pin_count[block_ref];
+  pthread_mutex_unlock(&vdisk_pin_lock);
+
+  if(debug)
+    fprintf(stderr, "##Pinned block %d\n", block_ref);
+  return(ret);
+}
+
+/**
+ *  Release a pin taken by vdisk_pin_block()
+ *
+ * @param block_ref Index of the block
+ *
+ */
+void vdisk_unpin_block(BLOCK_REFERENCE block_ref)
+{
+  if(block_ref >= N_BLOCKS_IN_DISK)
+    return;
+
+  pthread_mutex_lock(&vdisk_pin_lock);
+  if(vdisk_pin_count[block_ref] > 0 && --vdisk_pin_count[block_ref] == 0 &&
+     vdisk_pin_copy[block_ref] != NULL) {
+    free(vdisk_pin_copy[block_ref]);
+    vdisk_pin_copy[block_ref] = NULL;
+  }
+  pthread_mutex_unlock(&vdisk_pin_lock);
+}
+
+/**
+ *  Read a run of consecutive disk blocks, scattering the bytes over a list
+ *  of buffers, with a single system call
+ *
+ * @param block_ref Index of the first block
+ * @param n Number of blocks
+ * @param iov Buffers; their lengths must add up to n * BLOCK_SIZE
+ * @param iovcnt Number of buffers
+ * @return 0 on success; <0 on error
+ *
+ */
+int vdisk_readv_blocks(BLOCK_REFERENCE block_ref, int n, const struct iovec *iov, int iovcnt)
+{
+  if(debug)
+    fprintf(stderr, "##Reading blocks %d..%d (%d buffers)\n", block_ref, block_ref + n - 1, iovcnt);
+
+  // Make sure that the disk is initialized
+  if(vdisk_fd == 0) {
+    fprintf(stderr, "vdisk_readv_blocks(): disk not initialized\n");
+    exit(-1);
+  };
+
+  if(n <= 0 || block_ref + n > N_BLOCKS_IN_DISK) {
+    fprintf(stderr, "vdisk_readv_blocks(): bad block_ref(%d+%d)\n", block_ref, n);
+    return(-2);
+  }
+
+  if(preadv(vdisk_fd, iov, iovcnt, (off_t) block_ref * BLOCK_SIZE) != (ssize_t) n * BLOCK_SIZE) {
+    fprintf(stderr, "vdisk_readv_blocks(): read failed\n");
     return(-4);
   }
 
   // Success
   return(0);
 }
+
+/**
+ *  Write a run of consecutive disk blocks, gathering the bytes from a list
+ *  of buffers, with a single system call
+ *
+ * @param block_ref Index of the first block
+ * @param n Number of blocks
+ * @param iov Buffers; their lengths must add up to n * BLOCK_SIZE
+ * @param iovcnt Number of buffers
+ * @return 0 on success; <0 on error
+ *
+ */
+int vdisk_writev_blocks(BLOCK_REFERENCE block_ref, int n, const struct iovec *iov, int iovcnt)
+{
+  if(debug)
+    fprintf(stderr, "##Writing blocks %d..%d (%d buffers)\n", block_ref, block_ref + n - 1, iovcnt);
+
+  // File open?
+  if(vdisk_fd == 0) {
+    fprintf(stderr, "vdisk_writev_blocks(): disk not initialized\n");
+    exit(-1);
+  };
+
+  if(n <= 0 || block_ref + n > N_BLOCKS_IN_DISK) {
+    fprintf(stderr, "vdisk_writev_blocks(): bad block_ref(%d+%d)\n", block_ref, n);
+    return(-2);
+  }
+
+  if(pwritev(vdisk_fd, iov, iovcnt, (off_t) block_ref * BLOCK_SIZE) != (ssize_t) n * BLOCK_SIZE) {
+    fprintf(stderr, "vdisk_writev_blocks(): write failed\n");
+    return(-4);
+  }
+
+  // Keep pinned copies current
+  pthread_mutex_lock(&vdisk_pin_lock);
+  for(int i = 0; i < n; ++i) {
+    if(vdisk_pin_copy[block_ref + i] != NULL &&
+       pread(vdisk_fd, vdisk_pin_copy[block_ref + i], BLOCK_SIZE,
+	     (off_t) (block_ref + i) * BLOCK_SIZE) != BLOCK_SIZE)
+      fprintf(stderr, "vdisk_writev_blocks(): pinned copy of %d is stale\n", block_ref + i);
+  }
+  pthread_mutex_unlock(&vdisk_pin_lock);
+
+  // Success
+  return(0);
+}
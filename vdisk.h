@@ -6,6 +6,7 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/uio.h>
 
 typedef unsigned short BLOCK_REFERENCE;
 
@@ -19,5 +20,10 @@ int vdisk_disk_open(char *virtual_disk_name);
 int vdisk_disk_close();
 int vdisk_read_block(BLOCK_REFERENCE block_ref, void *block);
 int vdisk_write_block(BLOCK_REFERENCE block_ref, void *block);
+int vdisk_read_blocks(BLOCK_REFERENCE *block_refs, int n, void *blocks);
+const void *vdisk_pin_block(BLOCK_REFERENCE block_ref);
+void vdisk_unpin_block(BLOCK_REFERENCE block_ref);
+int vdisk_readv_blocks(BLOCK_REFERENCE block_ref, int n, const struct iovec *iov, int iovcnt);
+int vdisk_writev_blocks(BLOCK_REFERENCE block_ref, int n, const struct iovec *iov, int iovcnt);
 
 #endif
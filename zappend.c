@@ -0,0 +1,69 @@
+/**
+Append standard input to a file in the OU File System.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+
+#include "oufs_client.h"
+
+int main(int argc, char** argv) 
+{
+  // Fetch the key environment vars
+  char cwd[MAX_PATH_LENGTH];
+  char disk_name[MAX_PATH_LENGTH];
+  oufs_get_environment(cwd, disk_name);
+
+  int ret = 0;
+  // Check arguments
+  if(argc == 2) 
+  {
+    // Hand the work (and all of stdin) to oufsd if it is running
+    if(oufs_remote_running(disk_name))
+    {
+      static unsigned char data[OUFS_MAX_DATA];
+      int len = oufs_read_input(data, OUFS_MAX_DATA);
+      if(oufs_remote(disk_name, OUFS_OP_APPEND, 0, cwd, argv[1], NULL, data, len, &ret) == 0)
+	return(ret);
+      fprintf(stderr, "oufsd is not answering (remove its socket if it has stopped)\n");
+      return(-1);
+    }
+
+    // Open the virtual disk
+    if(vdisk_disk_open(disk_name) != 0)
+      return(-1);
+
+    OUFILE *fp = oufs_fopen(cwd, argv[1], "a");
+    if(fp == NULL)
+    {
+      vdisk_disk_close();
+      return(-1);
+    }
+
+    // One write per block of input (binary safe): the stream buffer
+    // coalesces them into block writes
+    unsigned char buf[BLOCK_SIZE];
+    int len;
+    while((len = fread(buf, 1, sizeof(buf), stdin)) > 0)
+    {
+      if(oufs_fwrite(fp, buf, len) != len)
+      {
+	fprintf(stderr, "%s: file is full\n", argv[1]);
+	ret = -1;
+	break;
+      }
+    }
+
+    // Clean up (the buffered data only gets its blocks here)
+    if(oufs_fclose(fp) != 0)
+      ret = -1;
+    vdisk_disk_close();
+  }else{
+    // Wrong number of parameters
+    fprintf(stderr, "Usage: zappend <filename>\n");
+    ret = -1;
+  }
+  return(ret);
+}
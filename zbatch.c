@@ -0,0 +1,304 @@
+/**
+Run a script of OU File System commands in one process.
+
+Usage: zbatch [<script>]   (the script is read from stdin if not given)
+
+One command per line; blank lines and lines starting with # are skipped:
+
+  cd [<dir>]                 pwd
+  mkdir <dir>                rmdir <dir>
+  touch <file>               remove <file>
+  ls [-l] [<name>]           more <file>
+  create <file> [<text>]     append <file> [<text>]
+  link [-c] <src> <dest>     truncate <file> <size>
+
+create and append write the rest of the line (plus a newline) to the file.
+The disk stays open for the whole script, so its caches stay warm.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "oufs_lib.h"
+
+// Most words looked at on one line
+#define MAX_WORDS 4
+
+/**
+ * Split off up to max words; *rest is left at the text after the last one
+ *
+ * @return Number of words found
+ */
+static int split_words(char *line, char **words, int max, char **rest)
+{
+  int n = 0;
+  char *p = line;
+
+  while(n < max)
+  {
+    while(isspace((unsigned char) *p))
+      p++;
+    if(*p == '\0')
+      break;
+    words[n++] = p;
+    while(*p != '\0' && !isspace((unsigned char) *p))
+      p++;
+    if(*p != '\0')
+      *p++ = '\0';
+  }
+  while(isspace((unsigned char) *p))
+    p++;
+  *rest = p;
+  return(n);
+}
+
+/**
+ * Change the working directory: check that path is a directory, then set
+ * cwd to its absolute path with . and .. folded away
+ *
+ * @return 0 on success; -1 on error
+ */
+static int change_directory(char *cwd, char *path)
+{
+  INODE_REFERENCE parent;
+  INODE_REFERENCE child;
+  INODE inode;
+  char local_name[MAX_PATH_LENGTH];
+  char joined[2 * MAX_PATH_LENGTH];
+  char result[MAX_PATH_LENGTH];
+
+  if(oufs_find_file(cwd, path, &parent, &child, local_name) < 0 ||
+     child == UNALLOCATED_INODE)
+  {
+    fprintf(stderr, "%s: not found\n", path);
+    return(-1);
+  }
+  oufs_read_inode_by_reference(child, &inode);
+  if(inode.type != IT_DIRECTORY)
+  {
+    fprintf(stderr, "%s: not a directory\n", path);
+    return(-1);
+  }
+
+  if(path[0] == '/')
+    snprintf(joined, sizeof(joined), "%s", path);
+  else
+    snprintf(joined, sizeof(joined), "%s/%s", cwd, path);
+
+  // Rebuild the path one component at a time
+  OUFS_PATH_ITER it;
+  const char *name;
+  size_t len;
+  size_t end = 0;
+  result[0] = '\0';
+  oufs_path_iter_init(&it, joined);
+  while(oufs_path_iter_next(&it, &name, &len))
+  {
+    if(len == 1 && name[0] == '.')
+      continue;
+    if(len == 2 && name[0] == '.' && name[1] == '.')
+    {
+      // Back up to the previous /
+      while(end > 0 && result[--end] != '/');
+      result[end] = '\0';
+      continue;
+    }
+    if(end + len + 2 > MAX_PATH_LENGTH)
+    {
+      fprintf(stderr, "%s: path too long\n", path);
+      return(-1);
+    }
+    result[end++] = '/';
+    memcpy(&result[end], name, len);
+    end += len;
+    result[end] = '\0';
+  }
+  strcpy(cwd, end == 0 ? "/" : result);
+  return(0);
+}
+
+/**
+ * Write text (and a newline) to a file
+ *
+ * @param mode "w" to replace the contents, "a" to append
+ * @return 0 on success; -1 on error
+ */
+static int write_text(char *cwd, char *path, char *text, char *mode)
+{
+  OUFILE *fp = oufs_fopen(cwd, path, mode);
+  if(fp == NULL)
+    return(-1);
+
+  int ret = 0;
+  int len = strlen(text);
+  if(len > 0)
+  {
+    text[len++] = '\n';
+    if(oufs_fwrite(fp, (unsigned char *) text, len) != len)
+    {
+      fprintf(stderr, "%s: file is full\n", path);
+      ret = -1;
+    }
+  }
+  if(oufs_fclose(fp) != 0)
+    ret = -1;
+  return(ret);
+}
+
+/**
+ * Copy a file to stdout
+ *
+ * @return 0 on success; -1 on error
+ */
+static int print_file(char *cwd, char *path)
+{
+  OUFILE *fp = oufs_fopen(cwd, path, "r");
+  if(fp == NULL)
+    return(-1);
+
+  const unsigned char *data;
+  int n;
+  while((n = oufs_fread_zerocopy(fp, &data, BLOCK_SIZE)) > 0)
+    fwrite(data, 1, n, stdout);
+  oufs_fclose(fp);
+  return(n < 0 ? -1 : 0);
+}
+
+/**
+ * Set the size of a file
+ *
+ * @return 0 on success; -1 on error
+ */
+static int truncate_file(char *cwd, char *path, char *size)
+{
+  OUFILE *fp = oufs_fopen(cwd, path, "a");
+  if(fp == NULL)
+    return(-1);
+  int ret = oufs_ftruncate(fp, atoi(size));
+  if(ret != 0)
+    fprintf(stderr, "%s: bad size %s\n", path, size);
+  if(oufs_fclose(fp) != 0)
+    ret = -1;
+  return(ret);
+}
+
+/**
+ * Run one command
+ *
+ * @param cwd Working directory (changed by cd)
+ * @param line The command (modified)
+ * @return 0 on success; -1 on error
+ */
+static int run_command(char *cwd, char *line)
+{
+  char *w[MAX_WORDS];
+  char *rest;
+
+  if(split_words(line, w, 1, &rest) == 0 || w[0][0] == '#')
+    return(0);
+
+  // Commands that take the rest of the line as text
+  if(strcmp(w[0], "create") == 0 || strcmp(w[0], "append") == 0)
+  {
+    if(split_words(rest, &w[1], 1, &rest) == 0)
+      goto usage;
+    return(write_text(cwd, w[1], rest, w[0][0] == 'c' ? "w" : "a"));
+  }
+
+  int n = 1 + split_words(rest, &w[1], MAX_WORDS - 1, &rest);
+  if(*rest != '\0')
+    goto usage;
+
+  if(strcmp(w[0], "cd") == 0 && n <= 2)
+    return(change_directory(cwd, n == 2 ? w[1] : "/"));
+  if(strcmp(w[0], "pwd") == 0 && n == 1)
+  {
+    printf("%s\n", cwd);
+    return(0);
+  }
+  if(strcmp(w[0], "mkdir") == 0 && n == 2)
+    return(oufs_mkdir(cwd, w[1]) < 0 ? -1 : 0);
+  if(strcmp(w[0], "rmdir") == 0 && n == 2)
+    return(oufs_rmdir(cwd, w[1]) < 0 ? -1 : 0);
+  if(strcmp(w[0], "touch") == 0 && n == 2)
+    return(oufs_ztouch(cwd, w[1]) < 0 ? -1 : 0);
+  if(strcmp(w[0], "remove") == 0 && n == 2)
+    return(oufs_remove(cwd, w[1]));
+  if(strcmp(w[0], "more") == 0 && n == 2)
+    return(print_file(cwd, w[1]));
+  if(strcmp(w[0], "truncate") == 0 && n == 3)
+    return(truncate_file(cwd, w[1], w[2]));
+  if(strcmp(w[0], "ls") == 0)
+  {
+    int long_format = (n > 1 && strcmp(w[1], "-l") == 0);
+    if(n - long_format > 2)
+      goto usage;
+    char *path = (n - long_format == 2) ? w[n - 1] : cwd;
+    return(long_format ? oufs_list_long(cwd, path) : oufs_list(cwd, path));
+  }
+  if(strcmp(w[0], "link") == 0)
+  {
+    if(n == 4 && strcmp(w[1], "-c") == 0)
+      return(oufs_clone(cwd, w[2], w[3]));
+    if(n == 3)
+      return(oufs_link(cwd, w[1], w[2]));
+  }
+
+ usage:
+  fprintf(stderr, "Unknown command or wrong arguments: %s\n", w[0]);
+  return(-1);
+}
+
+int main(int argc, char** argv)
+{
+  // Fetch the key environment vars
+  char cwd[MAX_PATH_LENGTH];
+  char disk_name[MAX_PATH_LENGTH];
+  oufs_get_environment(cwd, disk_name);
+
+  FILE *script = stdin;
+  if(argc > 2)
+  {
+    // Wrong number of parameters
+    fprintf(stderr, "Usage: zbatch [<script>]\n");
+    return(-1);
+  }
+  if(argc == 2 && (script = fopen(argv[1], "r")) == NULL)
+  {
+    perror(argv[1]);
+    return(-1);
+  }
+
+  // Open the virtual disk once for the whole script
+  if(vdisk_disk_open(disk_name) != 0)
+    return(-1);
+
+  // Lines of any length: a long create/append text is never split into a
+  // second command
+  char *line = NULL;
+  size_t line_size = 0;
+  int line_number = 0;
+  int ret = 0;
+  while(getline(&line, &line_size, script) != -1)
+  {
+    line_number++;
+    line[strcspn(line, "\n")] = '\0';
+    if(run_command(cwd, line) != 0)
+    {
+      fprintf(stderr, "zbatch: line %d failed\n", line_number);
+      ret = -1;
+    }
+  }
+
+  // Clean up
+  free(line);
+  vdisk_disk_close();
+  if(script != stdin)
+    fclose(script);
+  return(ret);
+}
@@ -1,33 +1,49 @@
-#include "vdisk.h"
+/**
+Create a file in the OU File System and fill it with standard input.
+
+CS3113
+
+*/
+
 #include <stdio.h>
 #include <string.h>
-#include "oufs_lib.h"
-#include "oufs.h"
+
+#include "oufs_client.h"
 
 int main(int argc, char** argv) 
 {
+  // Fetch the key environment vars
+  char cwd[MAX_PATH_LENGTH];
+  char disk_name[MAX_PATH_LENGTH];
+  oufs_get_environment(cwd, disk_name);
 
-    // string that contains the disk name
-    char disk_name[MAX_PATH_LENGTH];
-     // string used as a  current working directory with the size of the max path length
-    char cwd[MAX_PATH_LENGTH];
-    
-    // use custom API to fetch the key environment
-    oufs_get_environment(cwd, disk_name);
-    
-    // open the name of the virtual disk name that is passed in
-    vdisk_disk_open(disk_name);
-
-    
-
-    // create a data block that will be used for the following actions
-    //BLOCK block;
+  int ret = -1;
+  // Check arguments
+  if(argc == 2) 
+  {
+    // Hand the work (and all of stdin) to oufsd if it is running
+    if(oufs_remote_running(disk_name))
+    {
+      static unsigned char data[OUFS_MAX_DATA];
+      int len = oufs_read_input(data, OUFS_MAX_DATA);
+      if(oufs_remote(disk_name, OUFS_OP_CREATE, 0, cwd, argv[1], NULL, data, len, &ret) == 0)
+	return(ret);
+      fprintf(stderr, "oufsd is not answering (remove its socket if it has stopped)\n");
+      return(-1);
+    }
 
+    // Open the virtual disk
+    if(vdisk_disk_open(disk_name) != 0)
+      return(-1);
 
-    // write zeros to all bytes in the virtual disk
-    
-    // call oufs format disk to format disk name that is passed in
-    oufs_format_disk(disk_name);
+    // Create the file (truncating an existing one) and copy stdin into it
+    ret = oufs_zcreate(cwd, argv[1]);
 
+    // Clean up
     vdisk_disk_close();
+  }else{
+    // Wrong number of parameters
+    fprintf(stderr, "Usage: zcreate <filename>\n");
+  }
+  return(ret);
 }
@@ -0,0 +1,303 @@
+/**
+Defragment the OU File System on a virtual disk.
+
+Usage: zdefrag [-v]
+
+Each file and directory whose blocks are scattered is moved to a run of
+consecutive blocks (holes in a file stay holes).  Directories are visited
+first, in breadth-first order, and are also moved down whenever there is
+room closer to the inode table, so that they end up packed together near
+their inodes; files follow in the same order.  With -v, each move is shown.
+
+Moves are made in batches, and each batch is crash safe: the new blocks are
+marked allocated, the data is copied to them, the inodes are switched over
+(each inode block written once), and only then are the old blocks released
+(one update of the master block each time).  A crash at any point leaves
+every file intact; at worst some blocks stay allocated, which zfsck -r
+finds.  Blocks shared between clones are never moved.  Run zdefrag while
+nothing else is using the disk.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "oufs_lib.h"
+
+// Give up after this many batches
+#define MAX_PASSES 16
+
+// One planned move
+typedef struct move_s
+{
+  INODE_REFERENCE inode_reference;
+  int n_blocks;
+  BLOCK_REFERENCE from[BLOCKS_PER_INODE];
+  BLOCK_REFERENCE to;
+} MOVE;
+
+// The whole disk
+static BLOCK disk[N_BLOCKS_IN_DISK];
+static int verbose = 0;
+
+static INODE *inode_of(INODE_REFERENCE i)
+{
+  return(&disk[i / INODES_PER_BLOCK + 1].inodes.inode[i % INODES_PER_BLOCK]);
+}
+
+static int is_set(unsigned char *flags, int k)
+{
+  return((flags[k >> 3] >> (k & 7)) & 1);
+}
+
+static void set_bit(unsigned char *flags, int k, int value)
+{
+  if(value)
+    flags[k >> 3] |= (1 << (k & 7));
+  else
+    flags[k >> 3] &= ~(1 << (k & 7));
+}
+
+/**
+ * Read the whole disk with one batched read
+ *
+ * @return 0 on success; -1 on error
+ */
+static int load_disk()
+{
+  BLOCK_REFERENCE refs[N_BLOCKS_IN_DISK];
+  for(int b = 0; b < N_BLOCKS_IN_DISK; ++b)
+    refs[b] = b;
+  return(vdisk_read_blocks(refs, N_BLOCKS_IN_DISK, disk) == 0 ? 0 : -1);
+}
+
+/**
+ * List the inodes of the tree: directories breadth first, then files in the
+ * order they were found
+ *
+ * @return Number of inodes listed
+ */
+static int list_inodes(INODE_REFERENCE *order)
+{
+  INODE_REFERENCE files[N_INODES];
+  unsigned char seen[N_INODES] = { 0 };
+  int n_dirs = 0;
+  int n_files = 0;
+
+  order[n_dirs++] = 0;
+  seen[0] = 1;
+  for(int d = 0; d < n_dirs; ++d)
+  {
+    INODE *dir = inode_of(order[d]);
+    for(int b = 0; b < BLOCKS_PER_INODE; ++b)
+    {
+      if(dir->data[b] >= N_BLOCKS_IN_DISK)
+        continue;
+      for(int e = 0; e < DIRECTORY_ENTRIES_PER_BLOCK; ++e)
+      {
+        INODE_REFERENCE ref = disk[dir->data[b]].directory.entry[e].inode_reference;
+        if(ref >= N_INODES || seen[ref])
+          continue;
+        seen[ref] = 1;
+        if(inode_of(ref)->type == IT_DIRECTORY)
+          order[n_dirs++] = ref;
+        else if(inode_of(ref)->type == IT_FILE)
+          files[n_files++] = ref;
+      }
+    }
+  }
+  memcpy(&order[n_dirs], files, n_files * sizeof(INODE_REFERENCE));
+  return(n_dirs + n_files);
+}
+
+/**
+ * First fit: the lowest run of n blocks that are free
+ *
+ * @return First block of the run; -1 if there is none
+ */
+static int find_run(unsigned char *flags, int n)
+{
+  int run = 0;
+  for(int b = N_INODE_BLOCKS + 1; b < N_BLOCKS_IN_DISK; ++b)
+  {
+    run = is_set(flags, b) ? 0 : run + 1;
+    if(run == n)
+      return(b - n + 1);
+  }
+  return(-1);
+}
+
+/**
+ * Plan the moves of one batch: each inode that is scattered (or, for a
+ * directory, that could sit lower) gets the lowest free run that is not
+ * taken by an earlier move of the batch
+ *
+ * @param moves Filled in with the moves
+ * @param stuck Set to the number of scattered inodes with no room to move
+ * @return Number of moves
+ */
+static int plan(MOVE *moves, int *stuck)
+{
+  INODE_REFERENCE order[N_INODES];
+  unsigned char counts[N_BLOCKS_IN_DISK];
+  unsigned char flags[N_BLOCKS_IN_DISK >> 3];
+  int n_moves = 0;
+
+  *stuck = 0;
+  if(oufs_block_reference_counts(counts) != 0)
+    return(0);
+  memcpy(flags, disk[MASTER_BLOCK_REFERENCE].master.block_allocated_flag, sizeof(flags));
+
+  int n = list_inodes(order);
+  for(int k = 0; k < n; ++k)
+  {
+    INODE *inode = inode_of(order[k]);
+    MOVE *move = &moves[n_moves];
+    int shared = 0;
+    int scattered = 0;
+
+    move->inode_reference = order[k];
+    move->n_blocks = 0;
+    for(int b = 0; b < BLOCKS_PER_INODE; ++b)
+    {
+      BLOCK_REFERENCE ref = inode->data[b];
+      if(ref >= N_BLOCKS_IN_DISK)
+        continue;
+      if(counts[ref] > 1)
+        shared = 1;
+      if(move->n_blocks > 0 && ref != move->from[move->n_blocks - 1] + 1)
+        scattered = 1;
+      move->from[move->n_blocks++] = ref;
+    }
+    if(move->n_blocks == 0 || shared)
+      continue;
+
+    int to = find_run(flags, move->n_blocks);
+    if(!scattered && !(inode->type == IT_DIRECTORY && to >= 0 && to < move->from[0]))
+      continue;
+    if(to < 0)
+    {
+      (*stuck)++;
+      continue;
+    }
+    move->to = to;
+    for(int b = 0; b < move->n_blocks; ++b)
+      set_bit(flags, to + b, 1);
+    n_moves++;
+  }
+  return(n_moves);
+}
+
+/**
+ * Carry out the moves of a batch
+ *
+ * @return 0 on success; -1 on error
+ */
+static int commit(MOVE *moves, int n_moves)
+{
+  BLOCK master = disk[MASTER_BLOCK_REFERENCE];
+
+  // 1. Claim the new blocks
+  for(int m = 0; m < n_moves; ++m)
+    for(int b = 0; b < moves[m].n_blocks; ++b)
+      set_bit(master.master.block_allocated_flag, moves[m].to + b, 1);
+  if(vdisk_write_block(MASTER_BLOCK_REFERENCE, &master) != 0)
+    return(-1);
+
+  // 2. Copy the data: one write per move, gathered from the old blocks
+  for(int m = 0; m < n_moves; ++m)
+  {
+    struct iovec iov[BLOCKS_PER_INODE];
+    for(int b = 0; b < moves[m].n_blocks; ++b)
+    {
+      iov[b].iov_base = &disk[moves[m].from[b]];
+      iov[b].iov_len = BLOCK_SIZE;
+    }
+    if(vdisk_writev_blocks(moves[m].to, moves[m].n_blocks, iov, moves[m].n_blocks) != 0)
+      return(-1);
+  }
+
+  // 3. Switch the inodes over
+  INODE_REFERENCE refs[N_INODES];
+  INODE inodes[N_INODES];
+  for(int m = 0; m < n_moves; ++m)
+  {
+    refs[m] = moves[m].inode_reference;
+    inodes[m] = *inode_of(refs[m]);
+    for(int b = 0, k = 0; b < BLOCKS_PER_INODE; ++b)
+      if(inodes[m].data[b] < N_BLOCKS_IN_DISK)
+        inodes[m].data[b] = moves[m].to + k++;
+    if(verbose)
+      printf("inode %d: %d block%s from %d to %d\n", refs[m], moves[m].n_blocks,
+             moves[m].n_blocks == 1 ? "" : "s", moves[m].from[0], moves[m].to);
+  }
+  if(oufs_write_inodes(n_moves, refs, inodes) != 0)
+    return(-1);
+
+  // 4. Release the old blocks
+  for(int m = 0; m < n_moves; ++m)
+    for(int b = 0; b < moves[m].n_blocks; ++b)
+      set_bit(master.master.block_allocated_flag, moves[m].from[b], 0);
+  if(vdisk_write_block(MASTER_BLOCK_REFERENCE, &master) != 0)
+    return(-1);
+  return(0);
+}
+
+int main(int argc, char** argv)
+{
+  // Fetch the key environment vars
+  char cwd[MAX_PATH_LENGTH];
+  char disk_name[MAX_PATH_LENGTH];
+  oufs_get_environment(cwd, disk_name);
+
+  if(argc > 2 || (argc == 2 && strcmp(argv[1], "-v") != 0))
+  {
+    // Wrong parameters
+    fprintf(stderr, "Usage: zdefrag [-v]\n");
+    return(-1);
+  }
+  verbose = (argc == 2);
+
+  // Open the virtual disk
+  if(vdisk_disk_open(disk_name) != 0)
+    return(-1);
+
+  MOVE moves[N_INODES];
+  int moved = 0;
+  int blocks = 0;
+  int stuck = 0;
+  int pass;
+  for(pass = 0; pass < MAX_PASSES; ++pass)
+  {
+    if(load_disk() != 0)
+    {
+      vdisk_disk_close();
+      return(-1);
+    }
+    int n_moves = plan(moves, &stuck);
+    if(n_moves == 0)
+      break;
+    if(commit(moves, n_moves) != 0)
+    {
+      fprintf(stderr, "zdefrag: write error; run zfsck\n");
+      vdisk_disk_close();
+      return(-1);
+    }
+    moved += n_moves;
+    for(int m = 0; m < n_moves; ++m)
+      blocks += moves[m].n_blocks;
+  }
+
+  printf("zdefrag: %d move%s (%d block%s) in %d batch%s", moved, moved == 1 ? "" : "s",
+         blocks, blocks == 1 ? "" : "s", pass, pass == 1 ? "" : "es");
+  if(stuck > 0)
+    printf("; %d left scattered (no room)", stuck);
+  printf("\n");
+
+  // Clean up
+  vdisk_disk_close();
+  return(0);
+}
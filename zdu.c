@@ -0,0 +1,414 @@
+/**
+Report the disk usage of each directory of a tree in the OU File System.
+
+Usage: zdu [-s] [<dir>]   (the current working directory if not given)
+
+For each directory: the blocks in use and the bytes of file data below it
+(the directory itself included), then its path; subdirectories come before
+their parents.  With -s, only the total of <dir> is given.  A file with
+several names is counted once, in the directory that comes first by path,
+and a block shared by clones is counted once in each total that includes it.
+
+The inodes are fetched up front: the inode allocation table tells which
+inode blocks hold inodes in use, and those are read with one batched read.
+Directories are then read by a pool of threads, each with its own queue of
+directories to visit; a thread whose queue runs dry takes work from the
+others.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "oufs_lib.h"
+
+// Most worker threads
+#define MAX_WORKERS 8
+
+// One directory of the tree
+typedef struct node_s
+{
+  char path[MAX_PATH_LENGTH];
+  // Last component of the path (for ordering)
+  const char *name;
+  INODE_REFERENCE inode_reference;
+  int parent;
+  // Blocks used below this directory only (then, after the walk, including
+  // everything below it), one bit per block so that blocks shared by clones
+  // count once
+  unsigned char block_map[N_BLOCKS_IN_DISK / 8];
+  long blocks;
+  long bytes;
+  // Subdirectories, sorted by name once the walk is over
+  int *children;
+  int n_children;
+} NODE;
+
+// Directories to visit: the owner takes from the tail, others from the head
+typedef struct deque_s
+{
+  int items[N_INODES];
+  int head;
+  int tail;
+  pthread_mutex_t lock;
+} DEQUE;
+
+static NODE nodes[N_INODES];
+static int n_nodes = 0;
+
+static DEQUE deques[MAX_WORKERS];
+static int n_workers;
+
+// Directories queued and not yet finished; the walk is over at 0
+static int pending = 0;
+// Directories sitting in a queue
+static int queued = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_changed = PTHREAD_COND_INITIALIZER;
+
+// The inode table (only the blocks with inodes in use are read)
+static BLOCK inode_table[N_INODE_BLOCKS];
+// Files with several names are counted once, in the directory with the
+// first path
+static int owner[N_INODES];
+static pthread_mutex_t owner_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Paths are relative to the working directory, as given on the command line
+static char cwd[MAX_PATH_LENGTH];
+
+static INODE *inode_of(INODE_REFERENCE i)
+{
+  return(&inode_table[i / INODES_PER_BLOCK].inodes.inode[i % INODES_PER_BLOCK]);
+}
+
+/**
+ * Mark the blocks an inode holds in a directory's block map
+ */
+static void add_blocks(int index, INODE *inode)
+{
+  for(int b = 0; b < BLOCKS_PER_INODE; ++b)
+  {
+    BLOCK_REFERENCE ref = inode->data[b];
+    if(ref < N_BLOCKS_IN_DISK)
+      nodes[index].block_map[ref >> 3] |= 1 << (ref & 7);
+  }
+}
+
+/**
+ * Number of blocks marked in a block map
+ */
+static long count_blocks(const unsigned char *block_map)
+{
+  long n = 0;
+  for(int k = 0; k < N_BLOCKS_IN_DISK / 8; ++k)
+    n += __builtin_popcount(block_map[k]);
+  return(n);
+}
+
+/**
+ * Note that a directory holds a name of a file with several names; the file
+ * is counted in the directory with the first path, whichever thread gets
+ * there first
+ */
+static void claim(INODE_REFERENCE i, int index)
+{
+  pthread_mutex_lock(&owner_lock);
+  if(owner[i] < 0 || strcmp(nodes[index].path, nodes[owner[i]].path) < 0)
+    owner[i] = index;
+  pthread_mutex_unlock(&owner_lock);
+}
+
+/**
+ * Queue a directory on a worker's queue
+ */
+static void push(int worker, int node)
+{
+  // Counted first: once in the queue, it may be taken and finished at once
+  pthread_mutex_lock(&pool_lock);
+  pending++;
+  queued++;
+  pthread_mutex_unlock(&pool_lock);
+
+  DEQUE *d = &deques[worker];
+  pthread_mutex_lock(&d->lock);
+  d->items[d->tail++ % N_INODES] = node;
+  pthread_mutex_unlock(&d->lock);
+
+  pthread_mutex_lock(&pool_lock);
+  pthread_cond_signal(&pool_changed);
+  pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * Take a directory: the newest from our own queue, else the oldest from
+ * someone else's
+ *
+ * @return Node index; -1 if every queue is empty
+ */
+static int take(int worker)
+{
+  for(int k = 0; k < n_workers; ++k)
+  {
+    DEQUE *d = &deques[(worker + k) % n_workers];
+    int node = -1;
+    pthread_mutex_lock(&d->lock);
+    if(d->head < d->tail)
+      node = (k == 0) ? d->items[--d->tail % N_INODES] : d->items[d->head++ % N_INODES];
+    pthread_mutex_unlock(&d->lock);
+    if(node >= 0)
+    {
+      pthread_mutex_lock(&pool_lock);
+      queued--;
+      pthread_mutex_unlock(&pool_lock);
+      return(node);
+    }
+  }
+  return(-1);
+}
+
+/**
+ * Add a new directory node
+ *
+ * @return Its index
+ */
+static int add_node(const char *path, INODE_REFERENCE ref, int parent)
+{
+  pthread_mutex_lock(&pool_lock);
+  int index = n_nodes++;
+  pthread_mutex_unlock(&pool_lock);
+
+  NODE *node = &nodes[index];
+  snprintf(node->path, MAX_PATH_LENGTH, "%s", path);
+  const char *slash = strrchr(node->path, '/');
+  node->name = (slash != NULL && slash[1] != '\0') ? slash + 1 : node->path;
+  node->inode_reference = ref;
+  node->parent = parent;
+  memset(node->block_map, 0, sizeof(node->block_map));
+  add_blocks(index, inode_of(ref));
+  node->bytes = 0;
+  node->children = NULL;
+  node->n_children = 0;
+  return(index);
+}
+
+/**
+ * Visit one directory: count its files and queue its subdirectories
+ */
+static void visit(int worker, int index)
+{
+  OUDIR *dir = oufs_opendir(cwd, nodes[index].path);
+  if(dir == NULL)
+  {
+    fprintf(stderr, "%s: cannot read\n", nodes[index].path);
+    return;
+  }
+
+  OUDIRENT *entry;
+  while((entry = oufs_readdir(dir)) != NULL)
+  {
+    if(strcmp(entry->name, ".") == 0 || strcmp(entry->name, "..") == 0)
+      continue;
+    INODE *inode = inode_of(entry->inode_reference);
+    if(inode->type == IT_DIRECTORY)
+    {
+      char path[2 * MAX_PATH_LENGTH];
+      size_t len = strlen(nodes[index].path);
+      snprintf(path, sizeof(path), "%s%s%s", nodes[index].path,
+               (len > 0 && nodes[index].path[len - 1] == '/') ? "" : "/", entry->name);
+      if(strlen(path) >= MAX_PATH_LENGTH)
+      {
+        fprintf(stderr, "%s: path too long; skipped\n", path);
+        continue;
+      }
+      push(worker, add_node(path, entry->inode_reference, index));
+    }
+    else if(inode->n_references > 1)
+    {
+      claim(entry->inode_reference, index);
+    }else{
+      add_blocks(index, inode);
+      nodes[index].bytes += inode->size;
+    }
+  }
+  oufs_closedir(dir);
+}
+
+static void *worker(void *arg)
+{
+  int me = (int) (long) arg;
+
+  for(;;)
+  {
+    int node = take(me);
+    if(node >= 0)
+    {
+      visit(me, node);
+      pthread_mutex_lock(&pool_lock);
+      if(--pending == 0)
+        pthread_cond_broadcast(&pool_changed);
+      pthread_mutex_unlock(&pool_lock);
+      continue;
+    }
+
+    // Nothing to take: wait for more work or for the end of the walk
+    pthread_mutex_lock(&pool_lock);
+    while(pending > 0 && queued == 0)
+      pthread_cond_wait(&pool_changed, &pool_lock);
+    int done = (pending == 0);
+    pthread_mutex_unlock(&pool_lock);
+    if(done)
+      break;
+  }
+  return(NULL);
+}
+
+/**
+ * qsort() comparator: order node indices by name
+ */
+static int node_cmp(const void *a, const void *b)
+{
+  return(strcmp(nodes[*(const int *) a].name, nodes[*(const int *) b].name));
+}
+
+/**
+ * Print a directory after its subdirectories
+ */
+static void print_tree(int index)
+{
+  for(int c = 0; c < nodes[index].n_children; ++c)
+    print_tree(nodes[index].children[c]);
+  printf("%6ld %8ld %s\n", nodes[index].blocks, nodes[index].bytes, nodes[index].path);
+}
+
+int main(int argc, char** argv)
+{
+  // Fetch the key environment vars
+  char disk_name[MAX_PATH_LENGTH];
+  oufs_get_environment(cwd, disk_name);
+
+  int summary = 0;
+  int arg = 1;
+  if(argc > 1 && strcmp(argv[1], "-s") == 0)
+  {
+    summary = 1;
+    arg++;
+  }
+  if(argc - arg > 1)
+  {
+    // Wrong number of parameters
+    fprintf(stderr, "Usage: zdu [-s] [<dir>]\n");
+    return(-1);
+  }
+  char *path = (argc == arg) ? "." : argv[arg];
+
+  // Open the virtual disk
+  if(vdisk_disk_open(disk_name) != 0)
+    return(-1);
+
+  // Fetch only the inode blocks that hold inodes in use, in one read
+  BLOCK master;
+  BLOCK_REFERENCE refs[N_INODE_BLOCKS];
+  int n_refs = 0;
+  BLOCK in_use[N_INODE_BLOCKS];
+  vdisk_read_block(MASTER_BLOCK_REFERENCE, &master);
+  for(int b = 0; b < N_INODE_BLOCKS; ++b)
+  {
+    for(int i = b * INODES_PER_BLOCK; i < (b + 1) * INODES_PER_BLOCK; ++i)
+    {
+      if(master.master.inode_allocated_flag[i >> 3] & (1 << (i & 7)))
+      {
+        refs[n_refs++] = b + 1;
+        break;
+      }
+    }
+  }
+  if(vdisk_read_blocks(refs, n_refs, in_use) != 0)
+  {
+    vdisk_disk_close();
+    return(-1);
+  }
+  for(int k = 0; k < n_refs; ++k)
+    inode_table[refs[k] - 1] = in_use[k];
+
+  // The top of the tree
+  INODE_REFERENCE parent;
+  INODE_REFERENCE top;
+  char local_name[MAX_PATH_LENGTH];
+  if(oufs_find_file(cwd, path, &parent, &top, local_name) < 0 || top >= N_INODES ||
+     inode_of(top)->type != IT_DIRECTORY)
+  {
+    fprintf(stderr, "%s: not a directory\n", path);
+    vdisk_disk_close();
+    return(-1);
+  }
+
+  // Walk
+  for(int i = 0; i < N_INODES; ++i)
+    owner[i] = -1;
+  long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  n_workers = (n_cpus < 1) ? 1 : MIN(n_cpus, MAX_WORKERS);
+  for(int w = 0; w < n_workers; ++w)
+    pthread_mutex_init(&deques[w].lock, NULL);
+  push(0, add_node(path, top, -1));
+  pthread_t threads[MAX_WORKERS];
+  int started = 0;
+  for(int w = 0; w < n_workers; ++w)
+    if(pthread_create(&threads[w], NULL, worker, (void *) (long) w) == 0)
+      started++;
+  if(started == 0)
+    worker((void *) 0L);
+  for(int w = 0; w < started; ++w)
+    pthread_join(threads[w], NULL);
+
+  for(int i = 0; i < N_INODES; ++i)
+  {
+    if(owner[i] >= 0)
+    {
+      add_blocks(owner[i], inode_of(i));
+      nodes[owner[i]].bytes += inode_of(i)->size;
+    }
+  }
+
+  // Children are always added after their parents: add each total into its
+  // parent, last to first
+  for(int k = n_nodes - 1; k > 0; --k)
+  {
+    for(int b = 0; b < N_BLOCKS_IN_DISK / 8; ++b)
+      nodes[nodes[k].parent].block_map[b] |= nodes[k].block_map[b];
+    nodes[nodes[k].parent].bytes += nodes[k].bytes;
+  }
+  for(int k = 0; k < n_nodes; ++k)
+    nodes[k].blocks = count_blocks(nodes[k].block_map);
+
+  if(summary)
+  {
+    printf("%6ld %8ld %s\n", nodes[0].blocks, nodes[0].bytes, nodes[0].path);
+  }else{
+    for(int k = 1; k < n_nodes; ++k)
+      nodes[nodes[k].parent].n_children++;
+    for(int k = 0; k < n_nodes; ++k)
+    {
+      nodes[k].children = malloc((nodes[k].n_children + 1) * sizeof(int));
+      nodes[k].n_children = 0;
+    }
+    for(int k = 1; k < n_nodes; ++k)
+    {
+      NODE *p = &nodes[nodes[k].parent];
+      p->children[p->n_children++] = k;
+    }
+    for(int k = 0; k < n_nodes; ++k)
+      qsort(nodes[k].children, nodes[k].n_children, sizeof(int), node_cmp);
+    print_tree(0);
+    for(int k = 0; k < n_nodes; ++k)
+      free(nodes[k].children);
+  }
+
+  // Clean up
+  vdisk_disk_close();
+  return(0);
+}
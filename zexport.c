@@ -0,0 +1,478 @@
+/**
+Write a directory tree of the OU File System to stdout as a POSIX (ustar)
+tar archive.
+
+Usage: zexport [<name>]   (the current working directory if not given)
+
+Member names are relative to <name>.  Directories come first, then the
+files in the order of their first data block, so the disk is read from
+front to back; a reader thread fills a ring of buffers while the main
+thread writes them out.  A file with several names is stored once and its
+other names become hard links.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "oufs_lib.h"
+
+// tar works in records of this size
+#define TAR_BLOCK 512
+
+// Largest archive member: a header and a whole file, padded
+#define MAX_MEMBER (TAR_BLOCK + ((BLOCKS_PER_INODE * BLOCK_SIZE + TAR_BLOCK - 1) / TAR_BLOCK) * TAR_BLOCK)
+
+// Number of buffers between the reader and the writer
+#define N_SLOTS 4
+
+// ustar header
+typedef struct tar_header_s
+{
+  char name[100];
+  char mode[8];
+  char uid[8];
+  char gid[8];
+  char size[12];
+  char mtime[12];
+  char chksum[8];
+  char typeflag;
+  char linkname[100];
+  char magic[6];
+  char version[2];
+  char uname[32];
+  char gname[32];
+  char devmajor[8];
+  char devminor[8];
+  char prefix[155];
+  char pad[12];
+} TAR_HEADER;
+
+// One name to be archived
+typedef struct member_s
+{
+  char path[MAX_PATH_LENGTH];
+  INODE_REFERENCE inode_reference;
+  // Order in which the name was found
+  int sequence;
+  // Index of the member holding the data (hard links); -1 if this one does
+  int link;
+} MEMBER;
+
+static MEMBER *members = NULL;
+static int n_members = 0;
+static int max_members = 0;
+
+// The whole inode table
+static BLOCK inode_table[N_INODE_BLOCKS];
+
+// Modification time recorded for every member
+static time_t mtime;
+
+// Ring of buffers from the reader thread to the writer
+typedef struct slot_s
+{
+  int length;
+  unsigned char data[MAX_MEMBER];
+} SLOT;
+
+static SLOT slots[N_SLOTS];
+static int slot_head = 0;
+static int slot_count = 0;
+static int reader_done = 0;
+static int writer_failed = 0;
+static pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slot_filled = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t slot_emptied = PTHREAD_COND_INITIALIZER;
+
+// Files (in read order) for the reader thread
+static int *file_order;
+static int n_files;
+
+static INODE *inode_of(INODE_REFERENCE i)
+{
+  return(&inode_table[i / INODES_PER_BLOCK].inodes.inode[i % INODES_PER_BLOCK]);
+}
+
+/**
+ * Add a name to the member list
+ *
+ * @return 0 on success; -1 if out of memory
+ */
+static int add_member(const char *path, INODE_REFERENCE ref)
+{
+  if(n_members == max_members)
+  {
+    max_members = max_members ? 2 * max_members : N_INODES;
+    MEMBER *m = realloc(members, max_members * sizeof(MEMBER));
+    if(m == NULL)
+      return(-1);
+    members = m;
+  }
+  MEMBER *member = &members[n_members];
+  snprintf(member->path, MAX_PATH_LENGTH, "%s", path);
+  member->inode_reference = ref;
+  member->sequence = n_members;
+  member->link = -1;
+  n_members++;
+  return(0);
+}
+
+/**
+ * Collect every name below a directory, breadth first.  The blocks of each
+ * directory are fetched with one batched read.
+ *
+ * @return 0 on success; -1 on error
+ */
+static int walk(INODE_REFERENCE top)
+{
+  unsigned char visited[N_INODES] = { 0 };
+
+  visited[top] = 1;
+  // The top directory itself is not archived: start with its entries
+  for(int m = -1; m < n_members; ++m)
+  {
+    INODE_REFERENCE dir = (m < 0) ? top : members[m].inode_reference;
+    if(m >= 0 && (inode_of(dir)->type != IT_DIRECTORY || visited[dir]))
+      continue;
+    visited[dir] = 1;
+
+    BLOCK_REFERENCE refs[BLOCKS_PER_INODE];
+    BLOCK blocks[BLOCKS_PER_INODE];
+    int n = 0;
+    for(int b = 0; b < BLOCKS_PER_INODE; ++b)
+      if(inode_of(dir)->data[b] != UNALLOCATED_BLOCK)
+        refs[n++] = inode_of(dir)->data[b];
+    if(vdisk_read_blocks(refs, n, blocks) != 0)
+      return(-1);
+
+    for(int b = 0; b < n; ++b)
+    {
+      for(int e = 0; e < DIRECTORY_ENTRIES_PER_BLOCK; ++e)
+      {
+        DIRECTORY_ENTRY *entry = &blocks[b].directory.entry[e];
+        char name[FILE_NAME_SIZE + 1];
+        char path[2 * MAX_PATH_LENGTH];
+        if(entry->inode_reference >= N_INODES)
+          continue;
+        snprintf(name, sizeof(name), "%.*s", (int) FILE_NAME_SIZE, entry->name);
+        if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+          continue;
+        if(m < 0)
+          snprintf(path, sizeof(path), "%s", name);
+        else
+          snprintf(path, sizeof(path), "%s/%s", members[m].path, name);
+        if(strlen(path) >= MAX_PATH_LENGTH - 1)
+        {
+          fprintf(stderr, "%s: path too long; skipped\n", path);
+          continue;
+        }
+        if(add_member(path, entry->inode_reference) != 0)
+          return(-1);
+      }
+    }
+  }
+  return(0);
+}
+
+/**
+ * Fill in a tar header
+ *
+ * @param type '0' file, '1' hard link, '5' directory
+ * @return 0 on success; -1 if the path does not fit
+ */
+static int make_header(TAR_HEADER *h, const char *path, char type, int size, const char *linkname)
+{
+  char full[MAX_PATH_LENGTH + 1];
+  snprintf(full, sizeof(full), "%s%s", path, type == '5' ? "/" : "");
+  size_t len = strlen(full);
+
+  memset(h, 0, sizeof(TAR_HEADER));
+  if(len <= sizeof(h->name))
+  {
+    memcpy(h->name, full, len);
+  }else{
+    // Split at a / into prefix and name
+    char *split = NULL;
+    for(char *p = full; *p; ++p)
+      if(*p == '/' && p - full <= sizeof(h->prefix) && len - (p - full) - 1 <= sizeof(h->name))
+      {
+        split = p;
+        break;
+      }
+    if(split == NULL)
+      return(-1);
+    memcpy(h->prefix, full, split - full);
+    memcpy(h->name, split + 1, len - (split - full) - 1);
+  }
+
+  snprintf(h->mode, sizeof(h->mode), "%07o", type == '5' ? 0755 : 0644);
+  snprintf(h->uid, sizeof(h->uid), "%07o", 0);
+  snprintf(h->gid, sizeof(h->gid), "%07o", 0);
+  snprintf(h->size, sizeof(h->size), "%011o", size);
+  snprintf(h->mtime, sizeof(h->mtime), "%011lo", (unsigned long) mtime);
+  h->typeflag = type;
+  if(linkname != NULL)
+    strncpy(h->linkname, linkname, sizeof(h->linkname));
+  memcpy(h->magic, "ustar", 6);
+  memcpy(h->version, "00", 2);
+
+  // The checksum is taken with the checksum field full of spaces
+  unsigned int sum = 0;
+  memset(h->chksum, ' ', sizeof(h->chksum));
+  for(int i = 0; i < sizeof(TAR_HEADER); ++i)
+    sum += ((unsigned char *) h)[i];
+  snprintf(h->chksum, sizeof(h->chksum), "%06o", sum);
+  h->chksum[7] = ' ';
+  return(0);
+}
+
+/**
+ * Read a file's contents into a buffer, one read per run of consecutive
+ * blocks; holes read as zeros
+ *
+ * @return 0 on success; -1 on error
+ */
+static int read_file(INODE *inode, unsigned char *buf)
+{
+  int n_blocks = (inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+  for(int start = 0, end; start < n_blocks; start = end)
+  {
+    BLOCK_REFERENCE first = inode->data[start];
+    if(first == UNALLOCATED_BLOCK)
+    {
+      memset(buf + start * BLOCK_SIZE, 0, BLOCK_SIZE);
+      end = start + 1;
+      continue;
+    }
+    for(end = start + 1; end < n_blocks && inode->data[end] == first + (end - start); ++end);
+    struct iovec iov = { buf + start * BLOCK_SIZE, (end - start) * BLOCK_SIZE };
+    if(vdisk_readv_blocks(first, end - start, &iov, 1) != 0)
+      return(-1);
+  }
+  return(0);
+}
+
+/**
+ * Reader thread: turn each file into an archive member in the next free slot
+ */
+static void *reader(void *arg)
+{
+  for(int k = 0; k < n_files; ++k)
+  {
+    MEMBER *member = &members[file_order[k]];
+
+    pthread_mutex_lock(&slot_lock);
+    while(slot_count == N_SLOTS && !writer_failed)
+      pthread_cond_wait(&slot_emptied, &slot_lock);
+    if(writer_failed)
+    {
+      pthread_mutex_unlock(&slot_lock);
+      break;
+    }
+    SLOT *slot = &slots[(slot_head + slot_count) % N_SLOTS];
+    pthread_mutex_unlock(&slot_lock);
+
+    // Only this thread touches a free slot
+    TAR_HEADER *h = (TAR_HEADER *) slot->data;
+    INODE *inode = inode_of(member->inode_reference);
+    int size = (member->link < 0) ? inode->size : 0;
+    slot->length = 0;
+    if(make_header(h, member->path, member->link < 0 ? '0' : '1', size,
+                   member->link < 0 ? NULL : members[member->link].path) != 0)
+    {
+      fprintf(stderr, "%s: name does not fit in a tar header; skipped\n", member->path);
+      continue;
+    }
+    int padded = ((size + TAR_BLOCK - 1) / TAR_BLOCK) * TAR_BLOCK;
+    memset(slot->data + TAR_BLOCK, 0, padded);
+    if(size > 0 && read_file(inode, slot->data + TAR_BLOCK) != 0)
+    {
+      fprintf(stderr, "%s: read error; skipped\n", member->path);
+      continue;
+    }
+    // Bytes past the end of the file are padding
+    memset(slot->data + TAR_BLOCK + size, 0, padded - size);
+    slot->length = TAR_BLOCK + padded;
+
+    pthread_mutex_lock(&slot_lock);
+    slot_count++;
+    pthread_cond_signal(&slot_filled);
+    pthread_mutex_unlock(&slot_lock);
+  }
+
+  pthread_mutex_lock(&slot_lock);
+  reader_done = 1;
+  pthread_cond_signal(&slot_filled);
+  pthread_mutex_unlock(&slot_lock);
+  return(NULL);
+}
+
+/**
+ * qsort() comparator: files by first data block, then by inode, then in
+ * the order they were found
+ */
+static int file_cmp(const void *a, const void *b)
+{
+  const MEMBER *ma = &members[*(const int *) a];
+  const MEMBER *mb = &members[*(const int *) b];
+  int ba = inode_of(ma->inode_reference)->data[0];
+  int bb = inode_of(mb->inode_reference)->data[0];
+
+  if(ba != bb)
+    return(ba - bb);
+  if(ma->inode_reference != mb->inode_reference)
+    return(ma->inode_reference - mb->inode_reference);
+  return(ma->sequence - mb->sequence);
+}
+
+int main(int argc, char** argv)
+{
+  // Fetch the key environment vars
+  char cwd[MAX_PATH_LENGTH];
+  char disk_name[MAX_PATH_LENGTH];
+  oufs_get_environment(cwd, disk_name);
+
+  if(argc > 2)
+  {
+    // Wrong number of parameters
+    fprintf(stderr, "Usage: zexport [<name>]\n");
+    return(-1);
+  }
+
+  // Open the virtual disk
+  if(vdisk_disk_open(disk_name) != 0)
+    return(-1);
+
+  struct stat st;
+  mtime = (stat(disk_name, &st) == 0) ? st.st_mtime : time(NULL);
+
+  // The whole inode table in one read
+  BLOCK_REFERENCE inode_refs[N_INODE_BLOCKS];
+  for(int b = 0; b < N_INODE_BLOCKS; ++b)
+    inode_refs[b] = b + 1;
+  if(vdisk_read_blocks(inode_refs, N_INODE_BLOCKS, inode_table) != 0)
+  {
+    vdisk_disk_close();
+    return(-1);
+  }
+
+  INODE_REFERENCE parent;
+  INODE_REFERENCE top;
+  char local_name[MAX_PATH_LENGTH];
+  char *path = (argc == 2) ? argv[1] : cwd;
+  if(oufs_find_file(cwd, path, &parent, &top, local_name) < 0 || top >= N_INODES)
+  {
+    fprintf(stderr, "%s: not found\n", path);
+    vdisk_disk_close();
+    return(-1);
+  }
+
+  // A single file is archived under its own name
+  int ret = (inode_of(top)->type == IT_DIRECTORY) ? walk(top) : add_member(local_name, top);
+  if(ret != 0)
+  {
+    fprintf(stderr, "zexport: out of memory or read error\n");
+    vdisk_disk_close();
+    return(-1);
+  }
+
+  // Directories go first, in the order they were found; then the files
+  file_order = malloc((n_members > 0 ? n_members : 1) * sizeof(int));
+  if(file_order == NULL)
+  {
+    vdisk_disk_close();
+    return(-1);
+  }
+  n_files = 0;
+  for(int m = 0; m < n_members; ++m)
+  {
+    if(inode_of(members[m].inode_reference)->type == IT_DIRECTORY)
+    {
+      TAR_HEADER h;
+      if(make_header(&h, members[m].path, '5', 0, NULL) != 0)
+        fprintf(stderr, "%s: name does not fit in a tar header; skipped\n", members[m].path);
+      else
+        fwrite(&h, sizeof(h), 1, stdout);
+    }else{
+      file_order[n_files++] = m;
+    }
+  }
+  qsort(file_order, n_files, sizeof(int), file_cmp);
+
+  // The first name of each file carries the data; the others link to it
+  int data_holder[N_INODES];
+  for(int i = 0; i < N_INODES; ++i)
+    data_holder[i] = -1;
+  for(int k = 0; k < n_files; ++k)
+  {
+    MEMBER *member = &members[file_order[k]];
+    if(data_holder[member->inode_reference] < 0)
+      data_holder[member->inode_reference] = file_order[k];
+    else
+      member->link = data_holder[member->inode_reference];
+  }
+
+  // Read and write at the same time
+  pthread_t thread;
+  if(pthread_create(&thread, NULL, reader, NULL) != 0)
+  {
+    perror("pthread_create");
+    vdisk_disk_close();
+    return(-1);
+  }
+  ret = 0;
+  for(;;)
+  {
+    pthread_mutex_lock(&slot_lock);
+    while(slot_count == 0 && !reader_done)
+      pthread_cond_wait(&slot_filled, &slot_lock);
+    if(slot_count == 0)
+    {
+      pthread_mutex_unlock(&slot_lock);
+      break;
+    }
+    SLOT *slot = &slots[slot_head];
+    pthread_mutex_unlock(&slot_lock);
+
+    if(fwrite(slot->data, 1, slot->length, stdout) != slot->length)
+    {
+      // Let the reader go
+      perror("zexport");
+      pthread_mutex_lock(&slot_lock);
+      writer_failed = 1;
+      pthread_cond_signal(&slot_emptied);
+      pthread_mutex_unlock(&slot_lock);
+      ret = -1;
+      break;
+    }
+
+    pthread_mutex_lock(&slot_lock);
+    slot_head = (slot_head + 1) % N_SLOTS;
+    slot_count--;
+    pthread_cond_signal(&slot_emptied);
+    pthread_mutex_unlock(&slot_lock);
+  }
+  pthread_join(thread, NULL);
+
+  // End of archive: two empty records
+  if(ret == 0)
+  {
+    static char zeros[2 * TAR_BLOCK];
+    fwrite(zeros, 1, sizeof(zeros), stdout);
+    if(fflush(stdout) != 0)
+      ret = -1;
+  }
+
+  // Clean up
+  free(file_order);
+  free(members);
+  vdisk_disk_close();
+  return(ret);
+}
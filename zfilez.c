@@ -1,6 +1,6 @@
 #include <stdio.h>
 #include <string.h>
-#include "oufs_lib.h"
+#include "oufs_client.h"
 #include "vdisk.h"
 
 int main(int argc, char ** argv)
@@ -10,7 +10,7 @@ int main(int argc, char ** argv)
     /*
        Shell command:
 
-       ./zfilez [<name>]
+       ./zfilez [-l] [<name>]
     */
 
     /* Behavior: */
@@ -33,28 +33,50 @@ int main(int argc, char ** argv)
 
     char disk_name[MAX_PATH_LENGTH];
     char cwd[MAX_PATH_LENGTH];
+    int ret;
+    int long_format = 0;
+    int arg = 1;
 
-    INODE_REFERENCE inode_ref;
-    INODE inode;
-
+    // -l: long format (type, link count and size with each name)
+    if(argc > 1 && strcmp(argv[1], "-l") == 0)
+    {
+        long_format = 1;
+        arg++;
+    }
 
     oufs_get_environment(cwd, disk_name);
-    vdisk_disk_open(disk_name);
 
-    if(argc == 1) // if './filez' is typed, then list cwd
+    // Hand the work to oufsd if it is running
+    if(argc - arg <= 1)
     {
-        oufs_list(cwd, cwd);
+        int remote = oufs_remote(disk_name, OUFS_OP_LIST, long_format ? OUFS_FLAG_LONG : 0, cwd,
+                                 (argc == arg) ? NULL : argv[arg], NULL, NULL, 0, &ret);
+        if(remote != -1)
+            // Ran there, or reached oufsd without an answer: never run it twice
+            return(remote == 0 ? ret : -1);
     }
-    else if(argc > 1) // if a file is selected, list it
+
+    if(vdisk_disk_open(disk_name) != 0)
     {
-	// check if the argv is a file or directory
-        oufs_list(cwd, argv[1]);
+        return(-1);
+    }
+
+    // oufs_list() streams the directory through oufs_opendir()/oufs_readdir()
+    if(argc - arg <= 1)
+    {
+        // no name given: list cwd
+        char *path = (argc == arg) ? cwd : argv[arg];
+        if(long_format)
+            ret = oufs_list_long(cwd, path);
+        else
+            ret = oufs_list(cwd, path);
     }
     else
     {
-        fprintf(stderr, "invalid number of arguements\n");
+        fprintf(stderr, "Usage: zfilez [-l] [<name>]\n");
+        ret = -1;
     }
     vdisk_disk_close();
-   
-}
 
+    return(ret == 0 ? 0 : -1);
+}
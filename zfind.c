@@ -0,0 +1,408 @@
+/**
+Search a directory tree of the OU File System.
+
+Usage: zfind [<dir>] [-name <pattern>] [-type F|D] [-size [+|-]<n>] [-index <file>]
+
+Prints the path of every file and directory below <dir> (the current
+working directory if not given; <dir> itself included) that matches all of
+the tests:
+  -name <pattern>   the name matches the shell pattern (quote it)
+  -type F|D         it is a file (F) or a directory (D)
+  -size [+|-]<n>    its size is exactly, more than (+) or less than (-) n
+                    (bytes for a file, entries for a directory)
+
+The tree is walked breadth first; the blocks of all of the directories of
+one level are fetched with a single batched read.  With -index, the tree is
+saved in a host file and later searches use it instead of reading the disk,
+for as long as the disk has not been changed.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+#include "oufs_lib.h"
+
+#define INDEX_MAGIC "OUFSIDX1"
+
+// One name in the tree
+typedef struct record_s
+{
+  char name[FILE_NAME_SIZE];
+  INODE_REFERENCE inode_reference;
+  char type;
+  unsigned int size;
+  // Index of the directory holding this name (-1 for the top)
+  int parent;
+} RECORD;
+
+// Saved with the index: the disk it describes, as it was then
+typedef struct index_key_s
+{
+  char magic[8];
+  dev_t device;
+  ino_t inode;
+  off_t size;
+  struct timespec mtime;
+  int n_records;
+} INDEX_KEY;
+
+static RECORD *records = NULL;
+static int n_records = 0;
+static int max_records = 0;
+
+// The whole inode table
+static BLOCK inode_table[N_INODE_BLOCKS];
+
+static INODE *inode_of(INODE_REFERENCE i)
+{
+  return(&inode_table[i / INODES_PER_BLOCK].inodes.inode[i % INODES_PER_BLOCK]);
+}
+
+/**
+ * Add a name to the record list
+ *
+ * @return Its index; -1 if out of memory
+ */
+static int add_record(const char *name, INODE_REFERENCE ref, int parent)
+{
+  if(n_records == max_records)
+  {
+    max_records = max_records ? 2 * max_records : N_INODES;
+    RECORD *r = realloc(records, max_records * sizeof(RECORD));
+    if(r == NULL)
+      return(-1);
+    records = r;
+  }
+  RECORD *record = &records[n_records];
+  memset(record->name, 0, FILE_NAME_SIZE);
+  strncpy(record->name, name, FILE_NAME_SIZE - 1);
+  record->inode_reference = ref;
+  record->type = inode_of(ref)->type;
+  record->size = inode_of(ref)->size;
+  record->parent = parent;
+  return(n_records++);
+}
+
+/**
+ * qsort() comparator: order records by name
+ */
+static int record_cmp(const void *a, const void *b)
+{
+  return(strncmp(((const RECORD *) a)->name, ((const RECORD *) b)->name, FILE_NAME_SIZE));
+}
+
+/**
+ * Walk the tree below a directory breadth first: one batched read fetches
+ * the blocks of every directory of a level
+ *
+ * @param top Index of the record of the top directory
+ * @return 0 on success; -1 on error
+ */
+static int walk(int top)
+{
+  int level_start = top;
+  int level_end = top + 1;
+  unsigned char visited[N_INODES] = { 0 };
+
+  while(level_start < level_end)
+  {
+    // Every block of every directory of this level
+    BLOCK_REFERENCE refs[N_BLOCKS_IN_DISK];
+    int owner[N_BLOCKS_IN_DISK];
+    int n = 0;
+    for(int r = level_start; r < level_end; ++r)
+    {
+      INODE_REFERENCE dir = records[r].inode_reference;
+      if(records[r].type != IT_DIRECTORY || visited[dir])
+        continue;
+      visited[dir] = 1;
+      for(int b = 0; b < BLOCKS_PER_INODE && n < N_BLOCKS_IN_DISK; ++b)
+      {
+        if(inode_of(dir)->data[b] != UNALLOCATED_BLOCK)
+        {
+          refs[n] = inode_of(dir)->data[b];
+          owner[n++] = r;
+        }
+      }
+    }
+    BLOCK *blocks = malloc((n > 0 ? n : 1) * sizeof(BLOCK));
+    if(blocks == NULL || vdisk_read_blocks(refs, n, blocks) != 0)
+    {
+      free(blocks);
+      return(-1);
+    }
+
+    // The names found make up the next level, sorted within each directory
+    int next_start = n_records;
+    for(int k = 0; k < n; ++k)
+    {
+      int first = n_records;
+      for(int e = 0; e < DIRECTORY_ENTRIES_PER_BLOCK; ++e)
+      {
+        DIRECTORY_ENTRY *entry = &blocks[k].directory.entry[e];
+        char name[FILE_NAME_SIZE];
+        if(entry->inode_reference >= N_INODES)
+          continue;
+        strncpy(name, entry->name, FILE_NAME_SIZE);
+        name[FILE_NAME_SIZE - 1] = '\0';
+        if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+          continue;
+        if(add_record(name, entry->inode_reference, owner[k]) < 0)
+        {
+          free(blocks);
+          return(-1);
+        }
+      }
+      // Blocks of one directory are adjacent: sort once its last block is in
+      if(k + 1 == n || owner[k + 1] != owner[k])
+      {
+        while(first > next_start && records[first - 1].parent == owner[k])
+          first--;
+        qsort(&records[first], n_records - first, sizeof(RECORD), record_cmp);
+      }
+    }
+    free(blocks);
+    level_start = level_end;
+    level_end = n_records;
+  }
+  return(0);
+}
+
+/**
+ * Fill in the key of the index for the disk as it is now
+ *
+ * @return 0 on success; -1 on error
+ */
+static int index_key(char *disk_name, INDEX_KEY *key)
+{
+  struct stat st;
+  if(stat(disk_name, &st) != 0)
+    return(-1);
+  memset(key, 0, sizeof(INDEX_KEY));
+  memcpy(key->magic, INDEX_MAGIC, sizeof(key->magic));
+  key->device = st.st_dev;
+  key->inode = st.st_ino;
+  key->size = st.st_size;
+  key->mtime = st.st_mtim;
+  return(0);
+}
+
+/**
+ * Load the index if it describes the disk as it is now
+ *
+ * @return 0 on success; -1 if there is no usable index
+ */
+static int load_index(char *index_name, INDEX_KEY *now)
+{
+  INDEX_KEY key;
+  FILE *fp = fopen(index_name, "r");
+  if(fp == NULL)
+    return(-1);
+  int ret = -1;
+  if(fread(&key, sizeof(key), 1, fp) == 1 &&
+     memcmp(key.magic, now->magic, sizeof(key.magic)) == 0 &&
+     key.device == now->device && key.inode == now->inode && key.size == now->size &&
+     key.mtime.tv_sec == now->mtime.tv_sec && key.mtime.tv_nsec == now->mtime.tv_nsec &&
+     key.n_records > 0 &&
+     (records = malloc(key.n_records * sizeof(RECORD))) != NULL &&
+     fread(records, sizeof(RECORD), key.n_records, fp) == key.n_records)
+  {
+    n_records = max_records = key.n_records;
+    ret = 0;
+  }
+  fclose(fp);
+  if(ret != 0)
+  {
+    free(records);
+    records = NULL;
+  }
+  return(ret);
+}
+
+/**
+ * Save the records (of the whole tree) as the index; it is written to a
+ * temporary file that replaces the old index in one step
+ */
+static void save_index(char *index_name, INDEX_KEY *key)
+{
+  char temp_name[PATH_MAX];
+  snprintf(temp_name, sizeof(temp_name), "%s.tmp", index_name);
+  FILE *fp = fopen(temp_name, "w");
+  if(fp == NULL)
+  {
+    perror(temp_name);
+    return;
+  }
+  key->n_records = n_records;
+  int ok = (fwrite(key, sizeof(INDEX_KEY), 1, fp) == 1 &&
+            fwrite(records, sizeof(RECORD), n_records, fp) == n_records);
+  if(fclose(fp) != 0 || !ok || rename(temp_name, index_name) != 0)
+  {
+    perror(index_name);
+    unlink(temp_name);
+  }
+}
+
+/**
+ * Build the path of a record from the path of the top
+ */
+static void record_path(int r, int top, const char *top_path, char *path, size_t len)
+{
+  if(r == top)
+  {
+    snprintf(path, len, "%s", top_path);
+    return;
+  }
+  char parent_path[PATH_MAX];
+  record_path(records[r].parent, top, top_path, parent_path, sizeof(parent_path));
+  size_t n = strlen(parent_path);
+  snprintf(path, len, "%s%s%s", parent_path, (n > 0 && parent_path[n - 1] == '/') ? "" : "/",
+           records[r].name);
+}
+
+int main(int argc, char** argv)
+{
+  // Fetch the key environment vars
+  char cwd[MAX_PATH_LENGTH];
+  char disk_name[MAX_PATH_LENGTH];
+  oufs_get_environment(cwd, disk_name);
+
+  char *path = ".";
+  char *pattern = NULL;
+  char type = 0;
+  int size_sign = 0;
+  long size = -1;
+  char *index_name = NULL;
+  int arg = 1;
+  if(argc > 1 && argv[1][0] != '-')
+    path = argv[arg++];
+  for(; arg < argc; arg += 2)
+  {
+    if(arg + 1 >= argc)
+      break;
+    if(strcmp(argv[arg], "-name") == 0)
+      pattern = argv[arg + 1];
+    else if(strcmp(argv[arg], "-type") == 0 &&
+            (strcmp(argv[arg + 1], "F") == 0 || strcmp(argv[arg + 1], "D") == 0))
+      type = argv[arg + 1][0];
+    else if(strcmp(argv[arg], "-size") == 0)
+    {
+      char *s = argv[arg + 1];
+      size_sign = (*s == '+') ? 1 : (*s == '-') ? -1 : 0;
+      size = strtol(size_sign ? s + 1 : s, NULL, 10);
+    }
+    else if(strcmp(argv[arg], "-index") == 0)
+      index_name = argv[arg + 1];
+    else
+      break;
+  }
+  if(arg < argc)
+  {
+    // Wrong parameters
+    fprintf(stderr, "Usage: zfind [<dir>] [-name <pattern>] [-type F|D] [-size [+|-]<n>] [-index <file>]\n");
+    return(-1);
+  }
+
+  // Open the virtual disk
+  if(vdisk_disk_open(disk_name) != 0)
+    return(-1);
+
+  // The whole inode table in one read
+  BLOCK_REFERENCE inode_refs[N_INODE_BLOCKS];
+  for(int b = 0; b < N_INODE_BLOCKS; ++b)
+    inode_refs[b] = b + 1;
+  if(vdisk_read_blocks(inode_refs, N_INODE_BLOCKS, inode_table) != 0)
+  {
+    vdisk_disk_close();
+    return(-1);
+  }
+
+  INODE_REFERENCE parent;
+  INODE_REFERENCE start;
+  char local_name[MAX_PATH_LENGTH];
+  if(oufs_find_file(cwd, path, &parent, &start, local_name) < 0 || start >= N_INODES)
+  {
+    fprintf(stderr, "%s: not found\n", path);
+    vdisk_disk_close();
+    return(-1);
+  }
+
+  // Records of the tree: from the index, or by walking the disk (all of it
+  // if the index is to be saved)
+  int top = -1;
+  INDEX_KEY key;
+  int have_key = (index_name != NULL && index_key(disk_name, &key) == 0);
+  if(have_key && load_index(index_name, &key) == 0)
+  {
+    for(int r = 0; r < n_records && top < 0; ++r)
+      if(records[r].inode_reference == start)
+        top = r;
+  }
+  if(top < 0)
+  {
+    free(records);
+    records = NULL;
+    n_records = max_records = 0;
+    int ret;
+    if(have_key)
+    {
+      ret = (add_record("", 0, -1) < 0 || walk(0) != 0) ? -1 : 0;
+      for(int r = 0; r < n_records && top < 0; ++r)
+        if(records[r].inode_reference == start)
+          top = r;
+    }else{
+      top = add_record(local_name, start, -1);
+      ret = (top < 0 || walk(top) != 0) ? -1 : 0;
+    }
+    if(ret != 0 || top < 0)
+    {
+      fprintf(stderr, "zfind: out of memory or read error\n");
+      vdisk_disk_close();
+      return(-1);
+    }
+    if(have_key)
+      save_index(index_name, &key);
+  }
+  // The top's own name is the last component of the path as given
+  strncpy(records[top].name, local_name, FILE_NAME_SIZE - 1);
+
+  // Records come in breadth-first order, parents before children: a record
+  // is below the top if its parent is
+  unsigned char *below = calloc(n_records, 1);
+  if(below == NULL)
+  {
+    vdisk_disk_close();
+    return(-1);
+  }
+  for(int r = top; r < n_records; ++r)
+  {
+    RECORD *record = &records[r];
+    below[r] = (r == top) || (record->parent >= 0 && below[record->parent]);
+    if(!below[r])
+      continue;
+    if(pattern != NULL && fnmatch(pattern, record->name, 0) != 0)
+      continue;
+    if(type != 0 && record->type != type)
+      continue;
+    if(size >= 0 && !((size_sign == 0 && record->size == size) ||
+                      (size_sign > 0 && record->size > size) ||
+                      (size_sign < 0 && record->size < size)))
+      continue;
+    char found[PATH_MAX];
+    record_path(r, top, path, found, sizeof(found));
+    printf("%s\n", found);
+  }
+
+  // Clean up
+  free(below);
+  free(records);
+  vdisk_disk_close();
+  return(0);
+}
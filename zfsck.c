@@ -0,0 +1,526 @@
+/**
+Check the consistency of the OU File System on a virtual disk.
+
+Usage: zfsck [-r]
+
+The whole disk is read with one batched read.  Every inode is checked
+(block references in range, no block listed twice, a sane size) and every
+directory parsed by a pool of worker threads; a walk from the root then
+counts the names of each inode and finds the inodes and blocks that are in
+use, which are compared with the allocation tables of the master block,
+with n_references and with the size of each directory.
+
+With -r, the problems are repaired: bad directory entries are dropped,
+counts and sizes are set to what was found, lost inodes are released and
+both allocation tables are rebuilt.  Run zfsck while nothing else is using
+the disk.
+
+Exit status: 0 if the file system is consistent; 1 if problems were found
+and repaired; -1 if problems were found and left.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "oufs_lib.h"
+
+// Most worker threads
+#define MAX_WORKERS 8
+
+// Most entries in one directory
+#define MAX_ENTRIES (BLOCKS_PER_INODE * DIRECTORY_ENTRIES_PER_BLOCK)
+
+// One entry of a directory (other than . and ..)
+typedef struct child_s
+{
+  INODE_REFERENCE inode_reference;
+  // Where the entry lives: data[] index and slot
+  unsigned char block;
+  unsigned char slot;
+  // Set when the walk decides that the entry must go
+  unsigned char bad;
+} CHILD;
+
+// What is known about one inode
+typedef struct inode_check_s
+{
+  // Phase 1: the inode itself
+  // data[] slots that are out of range or repeat an earlier slot
+  unsigned bad_refs;
+  int bad_type;
+  // Directory: entries in use (including . and ..), the targets of . and
+  // .., and the other entries
+  int entries;
+  INODE_REFERENCE dot;
+  INODE_REFERENCE dotdot;
+  int n_children;
+  CHILD children[MAX_ENTRIES];
+
+  // Phase 2: the walk from the root
+  int reachable;
+  int references;
+  INODE_REFERENCE parent;
+
+  // Phase 3: verdicts
+  int wrong_references;
+  int wrong_size;
+  int lost;
+} INODE_CHECK;
+
+// The whole disk
+static BLOCK disk[N_BLOCKS_IN_DISK];
+static INODE_CHECK checks[N_INODES];
+static int problems = 0;
+static int repair = 0;
+
+// Blocks whose contents must be written back
+static unsigned char dirty[N_BLOCKS_IN_DISK];
+
+static INODE *inode_of(INODE_REFERENCE i)
+{
+  return(&disk[i / INODES_PER_BLOCK + 1].inodes.inode[i % INODES_PER_BLOCK]);
+}
+
+/**
+ * Report a problem
+ */
+static void problem(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+  printf("\n");
+  problems++;
+}
+
+/**********************************************************************/
+// Worker pool: each worker takes the next item until none are left
+
+typedef void (*TASK)(int item);
+
+typedef struct pool_s
+{
+  TASK task;
+  int n_items;
+  int next;
+  pthread_mutex_t lock;
+} POOL;
+
+static void *worker(void *arg)
+{
+  POOL *pool = (POOL *) arg;
+
+  for(;;)
+  {
+    pthread_mutex_lock(&pool->lock);
+    int item = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+    if(item >= pool->n_items)
+      break;
+    pool->task(item);
+  }
+  return(NULL);
+}
+
+/**
+ * Run a task for items 0 ... n_items-1 on the worker threads
+ */
+static void run_parallel(TASK task, int n_items)
+{
+  POOL pool = { task, n_items, 0, PTHREAD_MUTEX_INITIALIZER };
+  pthread_t threads[MAX_WORKERS];
+  long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int n_threads = (n_cpus < 1) ? 1 : MIN(n_cpus, MAX_WORKERS);
+  int started = 0;
+
+  for(int t = 0; t < n_threads; ++t)
+    if(pthread_create(&threads[t], NULL, worker, &pool) == 0)
+      started++;
+  // No threads at all: do the work here
+  if(started == 0)
+    worker(&pool);
+  for(int t = 0; t < started; ++t)
+    pthread_join(threads[t], NULL);
+}
+
+/**********************************************************************/
+// Phase 1: each inode on its own
+
+static int is_data_block(BLOCK_REFERENCE b)
+{
+  return(b > N_INODE_BLOCKS && b < N_BLOCKS_IN_DISK);
+}
+
+static void check_inode(int i)
+{
+  INODE *inode = inode_of(i);
+  INODE_CHECK *check = &checks[i];
+
+  if(inode->type != IT_FILE && inode->type != IT_DIRECTORY)
+  {
+    check->bad_type = (inode->type != IT_NONE);
+    return;
+  }
+
+  for(int b = 0; b < BLOCKS_PER_INODE; ++b)
+  {
+    if(inode->data[b] == UNALLOCATED_BLOCK)
+      continue;
+    if(!is_data_block(inode->data[b]))
+      check->bad_refs |= (1 << b);
+    for(int e = 0; e < b; ++e)
+      if(inode->data[e] == inode->data[b])
+        check->bad_refs |= (1 << b);
+  }
+
+  if(inode->type != IT_DIRECTORY)
+    return;
+
+  check->dot = check->dotdot = UNALLOCATED_INODE;
+  for(int b = 0; b < BLOCKS_PER_INODE; ++b)
+  {
+    if(inode->data[b] == UNALLOCATED_BLOCK || (check->bad_refs & (1 << b)))
+      continue;
+    DIRECTORY_BLOCK *block = &disk[inode->data[b]].directory;
+    for(int e = 0; e < DIRECTORY_ENTRIES_PER_BLOCK; ++e)
+    {
+      DIRECTORY_ENTRY *entry = &block->entry[e];
+      if(entry->inode_reference == UNALLOCATED_INODE)
+        continue;
+      check->entries++;
+      if(b == 0 && e == 0)
+        check->dot = entry->inode_reference;
+      else if(b == 0 && e == 1)
+        check->dotdot = entry->inode_reference;
+      else
+      {
+        CHILD *child = &check->children[check->n_children++];
+        child->inode_reference = entry->inode_reference;
+        child->block = b;
+        child->slot = e;
+        child->bad = 0;
+      }
+    }
+  }
+}
+
+/**********************************************************************/
+// Phase 2: walk the tree from the root
+
+static void walk()
+{
+  INODE_REFERENCE queue[N_INODES];
+  int head = 0;
+  int tail = 0;
+
+  checks[0].reachable = 1;
+  checks[0].references = 1;
+  checks[0].parent = 0;
+  queue[tail++] = 0;
+  while(head < tail)
+  {
+    INODE_REFERENCE dir = queue[head++];
+    INODE_CHECK *check = &checks[dir];
+    for(int c = 0; c < check->n_children; ++c)
+    {
+      CHILD *child = &check->children[c];
+      INODE_REFERENCE target = child->inode_reference;
+      if(target >= N_INODES || inode_of(target)->type == IT_NONE || checks[target].bad_type)
+      {
+        problem("inode %d: entry %d.%d refers to a bad inode (%d)", dir, child->block, child->slot, target);
+        child->bad = 1;
+        continue;
+      }
+      if(inode_of(target)->type == IT_DIRECTORY && checks[target].reachable)
+      {
+        problem("inode %d: entry %d.%d is a second name for directory %d", dir, child->block, child->slot, target);
+        child->bad = 1;
+        continue;
+      }
+      checks[target].references++;
+      if(!checks[target].reachable)
+      {
+        checks[target].reachable = 1;
+        checks[target].parent = dir;
+        if(inode_of(target)->type == IT_DIRECTORY)
+          queue[tail++] = target;
+      }
+    }
+  }
+}
+
+/**********************************************************************/
+// Phase 3: verdicts on each inode
+
+static void judge_inode(int i)
+{
+  INODE *inode = inode_of(i);
+  INODE_CHECK *check = &checks[i];
+
+  if(!check->reachable)
+  {
+    // Allocated (or not empty) but nobody refers to it
+    check->lost = (inode->type != IT_NONE);
+    return;
+  }
+  check->wrong_references = (inode->n_references != check->references);
+  if(inode->type == IT_DIRECTORY)
+  {
+    int bad = 0;
+    for(int c = 0; c < check->n_children; ++c)
+      bad += check->children[c].bad;
+    check->entries -= bad;
+    check->wrong_size = (inode->size != check->entries);
+  }else{
+    check->wrong_size = (inode->size > BLOCKS_PER_INODE * BLOCK_SIZE);
+  }
+}
+
+/**********************************************************************/
+// Repairs (in memory; written back at the end)
+
+static void mark_inode_dirty(INODE_REFERENCE i)
+{
+  dirty[i / INODES_PER_BLOCK + 1] = 1;
+}
+
+/**
+ * Drop a directory entry, keeping the rest of its block in order
+ */
+static void drop_entry(INODE *dir, CHILD *child)
+{
+  DIRECTORY_BLOCK *block = &disk[dir->data[child->block]].directory;
+  memmove(&block->entry[child->slot], &block->entry[child->slot + 1],
+          (DIRECTORY_ENTRIES_PER_BLOCK - child->slot - 1) * sizeof(DIRECTORY_ENTRY));
+  oufs_clean_directory_entry(&block->entry[DIRECTORY_ENTRIES_PER_BLOCK - 1]);
+  dirty[dir->data[child->block]] = 1;
+}
+
+/**
+ * Report (and repair) what was found about one inode
+ */
+static void settle_inode(INODE_REFERENCE i)
+{
+  INODE *inode = inode_of(i);
+  INODE_CHECK *check = &checks[i];
+
+  if(check->bad_type)
+  {
+    problem("inode %d: bad type %d", i, inode->type);
+    check->lost = 1;
+  }
+  if(check->lost)
+  {
+    if(!check->bad_type)
+      problem("inode %d: not reachable from the root", i);
+    if(repair)
+    {
+      memset(inode, 0, sizeof(INODE));
+      inode->type = IT_NONE;
+      inode->n_references = 1;
+      for(int b = 0; b < BLOCKS_PER_INODE; ++b)
+        inode->data[b] = UNALLOCATED_BLOCK;
+      mark_inode_dirty(i);
+    }
+    return;
+  }
+  if(!check->reachable)
+    return;
+
+  for(int b = 0; b < BLOCKS_PER_INODE; ++b)
+  {
+    if(check->bad_refs & (1 << b))
+    {
+      problem("inode %d: data[%d] refers to bad block %d", i, b, inode->data[b]);
+      if(repair)
+      {
+        inode->data[b] = UNALLOCATED_BLOCK;
+        mark_inode_dirty(i);
+      }
+    }
+  }
+
+  if(inode->type == IT_DIRECTORY)
+  {
+    if(inode->data[0] == UNALLOCATED_BLOCK || (check->bad_refs & 1))
+      problem("inode %d: directory has no first block", i);
+    else
+    {
+      DIRECTORY_BLOCK *block = &disk[inode->data[0]].directory;
+      if(check->dot != i)
+      {
+        problem("inode %d: . refers to %d", i, check->dot);
+        if(repair)
+        {
+          strcpy(block->entry[0].name, ".");
+          block->entry[0].inode_reference = i;
+          dirty[inode->data[0]] = 1;
+          if(check->dot == UNALLOCATED_INODE)
+            check->entries++;
+        }
+      }
+      if(check->dotdot != check->parent)
+      {
+        problem("inode %d: .. refers to %d instead of %d", i, check->dotdot, check->parent);
+        if(repair)
+        {
+          strcpy(block->entry[1].name, "..");
+          block->entry[1].inode_reference = check->parent;
+          dirty[inode->data[0]] = 1;
+          if(check->dotdot == UNALLOCATED_INODE)
+            check->entries++;
+        }
+      }
+    }
+    // Last to first, so that dropping an entry does not move the next one
+    for(int c = check->n_children - 1; repair && c >= 0; --c)
+      if(check->children[c].bad)
+        drop_entry(inode, &check->children[c]);
+    check->wrong_size = (inode->size != check->entries);
+  }
+
+  if(check->wrong_references)
+  {
+    problem("inode %d: n_references is %d; %d names found", i, inode->n_references, check->references);
+    if(repair)
+    {
+      inode->n_references = check->references;
+      mark_inode_dirty(i);
+    }
+  }
+  if(check->wrong_size)
+  {
+    int size = (inode->type == IT_DIRECTORY) ? check->entries : BLOCKS_PER_INODE * BLOCK_SIZE;
+    problem("inode %d: size is %u; should be %d", i, inode->size, size);
+    if(repair)
+    {
+      inode->size = size;
+      mark_inode_dirty(i);
+    }
+  }
+}
+
+/**
+ * Compare an allocation table with what is in use
+ */
+static void compare_table(const char *what, unsigned char *flags, unsigned char *in_use, int n)
+{
+  for(int k = 0; k < n; ++k)
+  {
+    int allocated = (flags[k >> 3] >> (k & 7)) & 1;
+    if(allocated && !in_use[k])
+      problem("%s %d: allocated but not in use", what, k);
+    else if(!allocated && in_use[k])
+      problem("%s %d: in use but not allocated", what, k);
+    if(repair)
+    {
+      if(in_use[k])
+        flags[k >> 3] |= (1 << (k & 7));
+      else
+        flags[k >> 3] &= ~(1 << (k & 7));
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  // Fetch the key environment vars
+  char cwd[MAX_PATH_LENGTH];
+  char disk_name[MAX_PATH_LENGTH];
+  oufs_get_environment(cwd, disk_name);
+
+  if(argc > 2 || (argc == 2 && strcmp(argv[1], "-r") != 0))
+  {
+    // Wrong parameters
+    fprintf(stderr, "Usage: zfsck [-r]\n");
+    return(-1);
+  }
+  repair = (argc == 2);
+
+  // Open the virtual disk
+  if(vdisk_disk_open(disk_name) != 0)
+    return(-1);
+
+  // All of it in one batched read
+  BLOCK_REFERENCE refs[N_BLOCKS_IN_DISK];
+  for(int b = 0; b < N_BLOCKS_IN_DISK; ++b)
+    refs[b] = b;
+  if(vdisk_read_blocks(refs, N_BLOCKS_IN_DISK, disk) != 0)
+  {
+    vdisk_disk_close();
+    return(-1);
+  }
+
+  if(inode_of(0)->type != IT_DIRECTORY)
+  {
+    fprintf(stderr, "zfsck: the root is not a directory; reformat the disk\n");
+    vdisk_disk_close();
+    return(-1);
+  }
+
+  run_parallel(check_inode, N_INODES);
+  walk();
+  run_parallel(judge_inode, N_INODES);
+  for(INODE_REFERENCE i = 0; i < N_INODES; ++i)
+    settle_inode(i);
+
+  // What should be allocated
+  unsigned char inode_in_use[N_INODES];
+  unsigned char block_in_use[N_BLOCKS_IN_DISK];
+  INODE_REFERENCE directory_owner[N_BLOCKS_IN_DISK];
+  memset(block_in_use, 0, sizeof(block_in_use));
+  for(int b = 0; b <= N_INODE_BLOCKS; ++b)
+    block_in_use[b] = 1;
+  for(int b = 0; b < N_BLOCKS_IN_DISK; ++b)
+    directory_owner[b] = UNALLOCATED_INODE;
+  for(INODE_REFERENCE i = 0; i < N_INODES; ++i)
+  {
+    INODE *inode = inode_of(i);
+    inode_in_use[i] = checks[i].reachable && !checks[i].lost;
+    if(!inode_in_use[i])
+      continue;
+    for(int b = 0; b < BLOCKS_PER_INODE; ++b)
+    {
+      BLOCK_REFERENCE ref = inode->data[b];
+      if(ref == UNALLOCATED_BLOCK || (checks[i].bad_refs & (1 << b)))
+        continue;
+      // Files may share blocks (clones); directories may not
+      if(block_in_use[ref] && (inode->type == IT_DIRECTORY || directory_owner[ref] != UNALLOCATED_INODE))
+        problem("block %d: used by directory %d and another inode",
+                ref, inode->type == IT_DIRECTORY ? i : directory_owner[ref]);
+      if(inode->type == IT_DIRECTORY)
+        directory_owner[ref] = i;
+      block_in_use[ref] = 1;
+    }
+  }
+  compare_table("inode", disk[MASTER_BLOCK_REFERENCE].master.inode_allocated_flag, inode_in_use, N_INODES);
+  compare_table("block", disk[MASTER_BLOCK_REFERENCE].master.block_allocated_flag, block_in_use, N_BLOCKS_IN_DISK);
+
+  // Write back: the inodes and directories first, the allocation tables last
+  if(repair && problems > 0)
+  {
+    for(int b = 1; b < N_BLOCKS_IN_DISK; ++b)
+      if(dirty[b])
+        vdisk_write_block(b, &disk[b]);
+    vdisk_write_block(MASTER_BLOCK_REFERENCE, &disk[MASTER_BLOCK_REFERENCE]);
+  }
+
+  // Clean up
+  vdisk_disk_close();
+  if(problems == 0)
+  {
+    printf("zfsck: no problems found\n");
+    return(0);
+  }
+  printf("zfsck: %d problem%s found%s\n", problems, problems == 1 ? "" : "s",
+         repair ? " and repaired" : "; run zfsck -r to repair");
+  return(repair ? 1 : -1);
+}
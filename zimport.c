@@ -0,0 +1,379 @@
+/**
+Copy a host directory tree (or a single host file) into the OU File System.
+
+Usage: zimport <host path> <name>
+
+<name> must not exist yet.  The whole tree is read first, so every inode and
+block it needs is allocated with one update of the master block; the data
+and directory blocks then go out in a few vectored writes, each inode block
+is written once, and the new tree only becomes visible when its top entry
+is added to the parent directory at the very end.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "oufs_lib.h"
+
+// One file or directory to be created
+typedef struct node_s
+{
+  char name[FILE_NAME_SIZE];
+  char type;
+  // File: size in bytes; directory: number of entries (including . and ..)
+  int size;
+  // Index of the parent node (-1 for the top of the tree)
+  int parent;
+  // Blocks of this node: block_refs[first_block ... first_block + n_blocks - 1]
+  int first_block;
+  int n_blocks;
+  char *host_path;
+} NODE;
+
+// A tree can never hold more files than there are inodes
+static NODE nodes[N_INODES];
+static int n_nodes = 0;
+static int n_blocks = 0;
+
+/**
+ * Number of blocks a directory with n entries needs
+ */
+static int directory_blocks(int n)
+{
+  return((n + DIRECTORY_ENTRIES_PER_BLOCK - 1) / DIRECTORY_ENTRIES_PER_BLOCK);
+}
+
+/**
+ * Add a host file or directory (and everything below it) to the node list
+ *
+ * @param host_path Path on the host
+ * @param name Name inside the OU File System
+ * @param parent Index of the parent node (-1 for the top)
+ * @return Index of the new node; -1 on error; -2 if the file was skipped
+ */
+static int scan(const char *host_path, const char *name, int parent)
+{
+  struct stat st;
+
+  if(lstat(host_path, &st) != 0)
+  {
+    perror(host_path);
+    return(-1);
+  }
+  if(!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode))
+  {
+    fprintf(stderr, "%s: not a file or directory; skipped\n", host_path);
+    return(-2);
+  }
+  if(strlen(name) >= FILE_NAME_SIZE)
+  {
+    fprintf(stderr, "%s: name longer than %d characters\n", host_path, (int) FILE_NAME_SIZE - 1);
+    return(-1);
+  }
+  if(S_ISREG(st.st_mode) && st.st_size > BLOCKS_PER_INODE * BLOCK_SIZE)
+  {
+    fprintf(stderr, "%s: larger than %d bytes\n", host_path, BLOCKS_PER_INODE * BLOCK_SIZE);
+    return(-1);
+  }
+  if(n_nodes == N_INODES)
+  {
+    fprintf(stderr, "%s: more than %d files\n", host_path, (int) N_INODES);
+    return(-1);
+  }
+
+  int index = n_nodes++;
+  NODE *node = &nodes[index];
+  memset(node->name, 0, FILE_NAME_SIZE);
+  strcpy(node->name, name);
+  node->parent = parent;
+  node->host_path = strdup(host_path);
+  if(S_ISREG(st.st_mode))
+  {
+    // Pre-size from the host's idea of the size
+    node->type = IT_FILE;
+    node->size = st.st_size;
+    node->n_blocks = (st.st_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    return(index);
+  }
+
+  node->type = IT_DIRECTORY;
+  node->size = 2;
+
+  DIR *dir = opendir(host_path);
+  if(dir == NULL)
+  {
+    perror(host_path);
+    return(-1);
+  }
+  struct dirent *entry;
+  while((entry = readdir(dir)) != NULL)
+  {
+    if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+    char child_path[PATH_MAX];
+    snprintf(child_path, sizeof(child_path), "%s/%s", host_path, entry->d_name);
+    int ret = scan(child_path, entry->d_name, index);
+    if(ret == -1)
+    {
+      closedir(dir);
+      return(-1);
+    }
+    if(ret >= 0)
+      nodes[index].size++;
+  }
+  closedir(dir);
+
+  node = &nodes[index];
+  node->n_blocks = directory_blocks(node->size);
+  if(node->n_blocks > BLOCKS_PER_INODE)
+  {
+    fprintf(stderr, "%s: too many entries\n", host_path);
+    return(-1);
+  }
+  return(index);
+}
+
+/**
+ * qsort() comparator: order node indices by name
+ */
+static int node_cmp(const void *a, const void *b)
+{
+  return(strncmp(nodes[*(const int *) a].name, nodes[*(const int *) b].name, FILE_NAME_SIZE));
+}
+
+/**
+ * Fill in the blocks of a directory: . and .., then the entries in sorted
+ * order
+ */
+static void fill_directory(int index, INODE_REFERENCE *inode_refs, INODE_REFERENCE top_parent,
+			   BLOCK *blocks)
+{
+  int children[N_INODES];
+  int n = 0;
+
+  for(int i = 0; i < n_nodes; ++i)
+    if(nodes[i].parent == index)
+      children[n++] = i;
+  qsort(children, n, sizeof(int), node_cmp);
+
+  BLOCK *block = &blocks[nodes[index].first_block];
+  INODE_REFERENCE parent = nodes[index].parent < 0 ? top_parent : inode_refs[nodes[index].parent];
+  oufs_clean_directory_block(inode_refs[index], parent, &block[0]);
+  for(int b = 1; b < nodes[index].n_blocks; ++b)
+    for(int e = 0; e < DIRECTORY_ENTRIES_PER_BLOCK; ++e)
+      oufs_clean_directory_entry(&block[b].directory.entry[e]);
+
+  for(int k = 0; k < n; ++k)
+  {
+    // . and .. take the first two slots
+    int slot = k + 2;
+    DIRECTORY_ENTRY *entry = &block[slot / DIRECTORY_ENTRIES_PER_BLOCK].directory.entry[slot % DIRECTORY_ENTRIES_PER_BLOCK];
+    memcpy(entry->name, nodes[children[k]].name, FILE_NAME_SIZE);
+    entry->inode_reference = inode_refs[children[k]];
+  }
+}
+
+/**
+ * Read the contents of a host file into its blocks; the rest of the last
+ * block is zeroed
+ *
+ * @return 0 on success; -1 on error
+ */
+static int fill_file(NODE *node, BLOCK *blocks)
+{
+  unsigned char *data = (unsigned char *) &blocks[node->first_block];
+  int room = node->n_blocks * BLOCK_SIZE;
+
+  memset(data, 0, room);
+  int fd = open(node->host_path, O_RDONLY);
+  if(fd < 0)
+  {
+    perror(node->host_path);
+    return(-1);
+  }
+  // The file may have shrunk since it was looked at
+  int n = 0;
+  ssize_t r;
+  while(n < room && (r = read(fd, data + n, room - n)) != 0)
+  {
+    if(r < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      perror(node->host_path);
+      close(fd);
+      return(-1);
+    }
+    n += r;
+  }
+  close(fd);
+  node->size = n;
+  return(0);
+}
+
+/**
+ * Write blocks, one vectored write per run of consecutive block references
+ *
+ * @return 0 on success; -1 on error
+ */
+static int write_blocks(BLOCK_REFERENCE *block_refs, BLOCK *blocks, int n)
+{
+  for(int start = 0, end; start < n; start = end)
+  {
+    for(end = start + 1; end < n && block_refs[end] == block_refs[end - 1] + 1; ++end);
+    struct iovec iov = { &blocks[start], (end - start) * BLOCK_SIZE };
+    if(vdisk_writev_blocks(block_refs[start], end - start, &iov, 1) != 0)
+      return(-1);
+  }
+  return(0);
+}
+
+/**
+ * Give back everything allocated for the tree
+ */
+static void release(INODE_REFERENCE *inode_refs, int n_inodes, BLOCK_REFERENCE *block_refs, int n)
+{
+  for(int i = 0; i < n_inodes; ++i)
+    oufs_deallocate_inode(inode_refs[i]);
+  for(int b = 0; b < n; ++b)
+    oufs_deallocate_block(block_refs[b]);
+}
+
+/**
+ * Count the clear bits of an allocation table
+ */
+static int count_free(unsigned char *flags, int n)
+{
+  int count = 0;
+  for(int i = 0; i < n; ++i)
+    if(!(flags[i >> 3] & (1 << (i & 7))))
+      count++;
+  return(count);
+}
+
+int main(int argc, char** argv)
+{
+  // Fetch the key environment vars
+  char cwd[MAX_PATH_LENGTH];
+  char disk_name[MAX_PATH_LENGTH];
+  oufs_get_environment(cwd, disk_name);
+
+  if(argc != 3)
+  {
+    // Wrong number of parameters
+    fprintf(stderr, "Usage: zimport <host path> <name>\n");
+    return(-1);
+  }
+
+  // Open the virtual disk
+  if(vdisk_disk_open(disk_name) != 0)
+    return(-1);
+
+  // Where the tree goes
+  INODE_REFERENCE parent;
+  INODE_REFERENCE child;
+  INODE parent_inode;
+  char local_name[MAX_PATH_LENGTH];
+  if(oufs_find_file(cwd, argv[2], &parent, &child, local_name) < -1 ||
+     parent == UNALLOCATED_INODE ||
+     oufs_read_inode_by_reference(parent, &parent_inode) != 0 ||
+     parent_inode.type != IT_DIRECTORY)
+  {
+    fprintf(stderr, "%s: parent directory does not exist\n", argv[2]);
+    vdisk_disk_close();
+    return(-1);
+  }
+  if(child != UNALLOCATED_INODE)
+  {
+    fprintf(stderr, "%s: already exists\n", argv[2]);
+    vdisk_disk_close();
+    return(-1);
+  }
+
+  // Look at the whole tree before touching the disk
+  if(scan(argv[1], local_name, -1) < 0)
+  {
+    vdisk_disk_close();
+    return(-1);
+  }
+  // Nodes are in depth-first order: each directory's blocks go just before
+  // its contents, and each file's blocks are consecutive
+  for(int i = 0; i < n_nodes; ++i)
+  {
+    nodes[i].first_block = n_blocks;
+    n_blocks += nodes[i].n_blocks;
+  }
+
+  BLOCK master;
+  vdisk_read_block(MASTER_BLOCK_REFERENCE, &master);
+  int free_inodes = count_free(master.master.inode_allocated_flag, N_INODES);
+  int free_blocks = count_free(master.master.block_allocated_flag, N_BLOCKS_IN_DISK);
+  if(n_nodes > free_inodes || n_blocks > free_blocks)
+  {
+    fprintf(stderr, "%s: needs %d inodes and %d blocks; %d and %d are free\n",
+            argv[1], n_nodes, n_blocks, free_inodes, free_blocks);
+    vdisk_disk_close();
+    return(-1);
+  }
+
+  // One update of the master block for the inodes, one for the blocks
+  INODE_REFERENCE inode_refs[N_INODES];
+  BLOCK_REFERENCE block_refs[N_BLOCKS_IN_DISK];
+  static BLOCK blocks[N_BLOCKS_IN_DISK];
+  int got_inodes = oufs_allocate_new_inodes(n_nodes, inode_refs);
+  int got_blocks = oufs_allocate_new_blocks(n_blocks, block_refs);
+  if(got_inodes < n_nodes || got_blocks < n_blocks)
+  {
+    fprintf(stderr, "%s: out of space\n", argv[1]);
+    release(inode_refs, got_inodes, block_refs, got_blocks);
+    vdisk_disk_close();
+    return(-1);
+  }
+  // Build the blocks in memory and write them out
+  for(int i = 0; i < n_nodes; ++i)
+  {
+    if(nodes[i].type == IT_DIRECTORY)
+      fill_directory(i, inode_refs, parent, blocks);
+    else if(fill_file(&nodes[i], blocks) != 0)
+      goto error;
+  }
+  if(write_blocks(block_refs, blocks, n_blocks) != 0)
+    goto error;
+
+  // Then the inodes
+  static INODE inodes[N_INODES];
+  for(int i = 0; i < n_nodes; ++i)
+  {
+    INODE *inode = &inodes[i];
+    memset(inode, 0, sizeof(INODE));
+    inode->type = nodes[i].type;
+    inode->n_references = 1;
+    for(int b = 0; b < BLOCKS_PER_INODE; ++b)
+      inode->data[b] = (b < nodes[i].n_blocks) ? block_refs[nodes[i].first_block + b] : UNALLOCATED_BLOCK;
+    inode->size = nodes[i].size;
+  }
+  if(oufs_write_inodes(n_nodes, inode_refs, inodes) != 0)
+    goto error;
+
+  // Nothing refers to the new tree until now
+  if(oufs_directory_insert_entry(parent, &parent_inode, local_name, inode_refs[0]) != 0)
+    goto error;
+
+  // Clean up
+  vdisk_disk_close();
+  return(0);
+
+ error:
+  release(inode_refs, n_nodes, block_refs, n_blocks);
+  vdisk_disk_close();
+  return(-1);
+}
@@ -0,0 +1,44 @@
+/**
+Link (or clone) a file in the OU File System.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "oufs_lib.h"
+
+int main(int argc, char** argv) 
+{
+  // Fetch the key environment vars
+  char cwd[MAX_PATH_LENGTH];
+  char disk_name[MAX_PATH_LENGTH];
+  oufs_get_environment(cwd, disk_name);
+
+  // -c: copy-on-write clone instead of a hard link
+  int clone = (argc == 4 && strcmp(argv[1], "-c") == 0);
+
+  int ret;
+  // Check arguments
+  if(argc == 3 || clone) 
+  {
+    // Open the virtual disk
+    if(vdisk_disk_open(disk_name) != 0)
+      return(-1);
+
+    if(clone)
+      ret = oufs_clone(cwd, argv[2], argv[3]);
+    else
+      ret = oufs_link(cwd, argv[1], argv[2]);
+
+    // Clean up
+    vdisk_disk_close();
+  }else{
+    // Wrong number of parameters
+    fprintf(stderr, "Usage: zlink [-c] <src name> <dest name>\n");
+    ret = -1;
+  }
+  return(ret);
+}
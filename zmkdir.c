@@ -8,7 +8,7 @@ CS3113
 #include <stdio.h>
 #include <string.h>
 
-#include "oufs_lib.h"
+#include "oufs_client.h"
 
 int main(int argc, char** argv) 
 {
@@ -22,6 +22,13 @@ int main(int argc, char** argv)
   // Check arguments
   if(argc == 2) 
   {
+    // Hand the work to oufsd if it is running
+    int ret;
+    int remote = oufs_remote(disk_name, OUFS_OP_MKDIR, 0, cwd, argv[1], NULL, NULL, 0, &ret);
+    if(remote != -1)
+      // Ran there, or reached oufsd without an answer: never run it twice
+      return(remote == 0 ? ret : -1);
+
     // Open the virtual disk
     vdisk_disk_open(disk_name);
 
@@ -0,0 +1,58 @@
+/**
+Print the contents of a file in the OU File System.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "oufs_client.h"
+
+int main(int argc, char** argv) 
+{
+  // Fetch the key environment vars
+  char cwd[MAX_PATH_LENGTH];
+  char disk_name[MAX_PATH_LENGTH];
+  oufs_get_environment(cwd, disk_name);
+
+  // Check arguments
+  if(argc == 2) 
+  {
+    // Hand the work to oufsd if it is running
+    int ret;
+    int remote = oufs_remote(disk_name, OUFS_OP_READ, 0, cwd, argv[1], NULL, NULL, 0, &ret);
+    if(remote != -1)
+      // Ran there, or reached oufsd without an answer: never run it twice
+      return(remote == 0 ? ret : -1);
+
+    // Open the virtual disk
+    if(vdisk_disk_open(disk_name) != 0)
+      return(-1);
+
+    OUFILE *fp = oufs_fopen(cwd, argv[1], "r");
+    if(fp == NULL)
+    {
+      vdisk_disk_close();
+      return(-1);
+    }
+
+    // Copy the file to stdout straight from the disk blocks
+    const unsigned char *data;
+    int n;
+    while((n = oufs_fread_zerocopy(fp, &data, BLOCK_SIZE)) > 0)
+    {
+      fwrite(data, 1, n, stdout);
+    }
+
+    // Clean up
+    oufs_fclose(fp);
+    vdisk_disk_close();
+  }else{
+    // Wrong number of parameters
+    fprintf(stderr, "Usage: zmore <filename>\n");
+    return(-1);
+  }
+  return(0);
+}
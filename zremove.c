@@ -0,0 +1,44 @@
+/**
+Remove a file from the OU File System.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "oufs_client.h"
+
+int main(int argc, char** argv) 
+{
+  // Fetch the key environment vars
+  char cwd[MAX_PATH_LENGTH];
+  char disk_name[MAX_PATH_LENGTH];
+  oufs_get_environment(cwd, disk_name);
+
+  int ret;
+  // Check arguments
+  if(argc == 2) 
+  {
+    // Hand the work to oufsd if it is running
+    int remote = oufs_remote(disk_name, OUFS_OP_REMOVE, 0, cwd, argv[1], NULL, NULL, 0, &ret);
+    if(remote != -1)
+      // Ran there, or reached oufsd without an answer: never run it twice
+      return(remote == 0 ? ret : -1);
+
+    // Open the virtual disk
+    if(vdisk_disk_open(disk_name) != 0)
+      return(-1);
+
+    ret = oufs_remove(cwd, argv[1]);
+
+    // Clean up
+    vdisk_disk_close();
+  }else{
+    // Wrong number of parameters
+    fprintf(stderr, "Usage: zremove <filename>\n");
+    ret = -1;
+  }
+  return(ret);
+}
@@ -0,0 +1,57 @@
+/**
+Remove a file, or with -r a directory and everything below it, from the
+OU File System.
+
+Usage: zrm [-r] <name>
+
+With -r the whole subtree goes at once: its inodes and blocks are released
+with one update of the master block and one write of each inode block
+involved, however many entries it holds.  Files that also have names
+elsewhere keep them.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "oufs_client.h"
+
+int main(int argc, char** argv)
+{
+  // Fetch the key environment vars
+  char cwd[MAX_PATH_LENGTH];
+  char disk_name[MAX_PATH_LENGTH];
+  oufs_get_environment(cwd, disk_name);
+
+  int recursive = (argc == 3 && strcmp(argv[1], "-r") == 0);
+  if(argc != 2 + recursive)
+  {
+    // Wrong parameters
+    fprintf(stderr, "Usage: zrm [-r] <name>\n");
+    return(-1);
+  }
+  char *name = argv[argc - 1];
+
+  // Hand the work to oufsd if it is running
+  int ret;
+  int remote = oufs_remote(disk_name, OUFS_OP_REMOVE, recursive ? OUFS_FLAG_RECURSIVE : 0, cwd,
+                           name, NULL, NULL, 0, &ret);
+  if(remote != -1)
+    // Ran there, or reached oufsd without an answer: never run it twice
+    return(remote == 0 ? ret : -1);
+
+  // Open the virtual disk
+  if(vdisk_disk_open(disk_name) != 0)
+    return(-1);
+
+  if(recursive)
+    ret = oufs_remove_recursive(cwd, name);
+  else
+    ret = oufs_remove(cwd, name);
+
+  // Clean up
+  vdisk_disk_close();
+  return(ret);
+}
@@ -3,7 +3,7 @@
 #include <dirent.h>
 #include <string.h>
 #include <sys/stat.h>
-#include "oufs_lib.h"
+#include "oufs_client.h"
 
 int main(int argc, char **argv)
 {
@@ -16,6 +16,13 @@ int main(int argc, char **argv)
 
     if(argc == 2)
     {
+        // Hand the work to oufsd if it is running
+        int ret;
+        int remote = oufs_remote(disk_name, OUFS_OP_TOUCH, 0, cwd, argv[1], NULL, NULL, 0, &ret);
+        if(remote != -1)
+            // Ran there, or reached oufsd without an answer: never run it twice
+            return(remote == 0 ? ret : -1);
+
         vdisk_disk_open(disk_name);
 
 	
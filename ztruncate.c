@@ -0,0 +1,50 @@
+/**
+Set the size of a file in the OU File System.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "oufs_lib.h"
+
+int main(int argc, char** argv) 
+{
+  // Fetch the key environment vars
+  char cwd[MAX_PATH_LENGTH];
+  char disk_name[MAX_PATH_LENGTH];
+  oufs_get_environment(cwd, disk_name);
+
+  int ret;
+  // Check arguments
+  if(argc == 3) 
+  {
+    // Open the virtual disk
+    if(vdisk_disk_open(disk_name) != 0)
+      return(-1);
+
+    // Append mode: the file is created if needed but not emptied
+    OUFILE *fp = oufs_fopen(cwd, argv[1], "a");
+    if(fp == NULL)
+    {
+      vdisk_disk_close();
+      return(-1);
+    }
+    ret = oufs_ftruncate(fp, atoi(argv[2]));
+    if(ret != 0)
+      fprintf(stderr, "%s: bad size %s\n", argv[1], argv[2]);
+
+    // Clean up
+    if(oufs_fclose(fp) != 0)
+      ret = -1;
+    vdisk_disk_close();
+  }else{
+    // Wrong number of parameters
+    fprintf(stderr, "Usage: ztruncate <filename> <size>\n");
+    ret = -1;
+  }
+  return(ret);
+}